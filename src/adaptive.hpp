@@ -0,0 +1,72 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace poor_perf
+{
+
+/**
+ * Lowest frequency the sampling is ramped down to, in Hz, and how many times
+ * at most the period is doubled when it is sampled with one.
+ */
+constexpr std::uint64_t lowest_ramped_frequency = 100;
+constexpr std::uint64_t most_ramped_doublings = 6;
+
+/**
+ * When a profile ends on its own rather than after a fixed duration: not
+ * before `min_duration`, `grace` after the system was starved for the last
+ * time and not after `max_duration`.
+ */
+struct adaptive_limits
+{
+    std::chrono::seconds min_duration{0};
+    std::chrono::seconds max_duration{0};
+    std::chrono::milliseconds grace{0};
+
+    // how often the sampling frequency is halved, 0 keeps it
+    std::chrono::seconds ramp_down{0};
+};
+
+/**
+ * What an adaptive profile does next.
+ */
+struct adaptive_step
+{
+    bool stop = false;
+
+    // frequency or period the event is sampled with from now on
+    std::uint64_t rate = 0;
+};
+
+/**
+ * Decides about a profile taken for `elapsed` on a system which was starved
+ * for the last time `since_starved` ago. It started with `rate`, a frequency
+ * which is halved, or a period which is doubled instead when `period` is set.
+ * A frequency which is already below the lowest one is kept.
+ */
+inline adaptive_step next_adaptive_step(const adaptive_limits& limits, std::uint64_t rate, bool period,
+    std::chrono::nanoseconds elapsed, std::chrono::nanoseconds since_starved)
+{
+    adaptive_step ret;
+    ret.stop = elapsed >= limits.max_duration || (elapsed >= limits.min_duration && since_starved >= limits.grace);
+    ret.rate = rate;
+
+    if (limits.ramp_down.count())
+    {
+        const auto halvings = std::min<std::uint64_t>(elapsed / limits.ramp_down, 63);
+        ret.rate = period ? rate << std::min(halvings, most_ramped_doublings)
+            : std::max(rate >> halvings, std::min(rate, lowest_ramped_frequency));
+    }
+
+    return ret;
+}
+
+} // namespace
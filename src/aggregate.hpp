@@ -0,0 +1,148 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "perf.hpp"
+#include "proc.hpp"
+#include "region_index.hpp"
+#include "output.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Samples counted per (pid, comm, pathname, addr), optionally split into
+ * buckets of time, instead of being written one by one.
+ */
+struct sample_histogram
+{
+    /**
+     * With `bucket` of zero, there is a single bucket for the whole profile.
+     */
+    explicit sample_histogram(std::uint64_t bucket) : _bucket(bucket)
+    {
+    }
+
+    void add(const running_processes_snapshot& processes, const sample_t& sample)
+    {
+        auto s = processes.find_symbol(sample.pid, sample.ip);
+
+        key k;
+        k.bucket = _bucket ? sample.time / _bucket * _bucket : 0;
+        k.pid = sample.pid;
+        k.comm = _strings.intern(s.comm);
+        k.pathname = _strings.intern(s.pathname);
+        k.addr = s.addr;
+
+        auto it = _counts.find(k);
+        if (it == _counts.end())
+            _counts.emplace(k, value{1, _strings.intern(s.name)});
+        else
+            it->second.count++;
+    }
+
+    /**
+     * Writes the histogram of every bucket from the most frequent entry,
+     * with its share of the samples in the bucket, and forgets it.
+     */
+    void write(output_stream& output)
+    {
+        std::vector<std::pair<key, value>> sorted{_counts.begin(), _counts.end()};
+        std::sort(sorted.begin(), sorted.end(), [this](const auto& a, const auto& b)
+        {
+            if (a.first.bucket != b.first.bucket)
+                return a.first.bucket < b.first.bucket;
+            if (a.second.count != b.second.count)
+                return a.second.count > b.second.count;
+
+            // equal counts come in the same order whatever order they were hit in
+            auto order = [this](const key& k)
+            {
+                return std::forward_as_tuple(k.pid, _strings.get(k.comm), _strings.get(k.pathname), k.addr);
+            };
+            return order(a.first) < order(b.first);
+        });
+
+        std::unordered_map<std::uint64_t, std::uint64_t> totals;
+        for (const auto& [k, v] : sorted)
+            totals[k.bucket] += v.count;
+
+        output.write(_bucket ? "$ bucket;count;percent;pid;comm;pathname;addr;name\n" : "$ count;percent;pid;comm;pathname;addr;name\n");
+
+        for (const auto& [k, v] : sorted)
+        {
+            if (_bucket)
+                output.write_dec(k.bucket).write(';');
+
+            // hundredths of a percent, rounded
+            const auto total = totals[k.bucket];
+            const auto share = (v.count * 20000 + total) / (2 * total);
+
+            output.write_dec(v.count).write(';')
+                  .write_dec(share / 100).write('.').write(char('0' + share / 10 % 10)).write(char('0' + share % 10)).write(';')
+                  .write_dec(k.pid).write(';')
+                  .write(_strings.get(k.comm)).write(';')
+                  .write(_strings.get(k.pathname))
+                  .write(";0x").write_hex(k.addr).write(';')
+                  .write(_strings.get(v.name)).write('\n');
+        }
+
+        _counts.clear();
+    }
+
+    auto size() const
+    {
+        return _counts.size();
+    }
+
+private:
+    struct key
+    {
+        std::uint64_t bucket;
+        std::uint64_t addr;
+        std::uint32_t pid;
+        std::uint32_t comm;
+        std::uint32_t pathname;
+
+        bool operator==(const key& other) const
+        {
+            return bucket == other.bucket && addr == other.addr && pid == other.pid &&
+                comm == other.comm && pathname == other.pathname;
+        }
+    };
+
+    struct key_hash
+    {
+        std::size_t operator()(const key& k) const
+        {
+            // boost::hash_combine
+            std::size_t seed = 0;
+            for (std::uint64_t v : {k.bucket, k.addr, std::uint64_t(k.pid), std::uint64_t(k.comm), std::uint64_t(k.pathname)})
+                seed ^= std::hash<std::uint64_t>{}(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+
+    struct value
+    {
+        std::uint64_t count;
+        std::uint32_t name;
+    };
+
+    std::uint64_t _bucket;
+    string_table _strings;
+    std::unordered_map<key, value, key_hash> _counts;
+};
+
+} // namespace
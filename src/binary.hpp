@@ -0,0 +1,203 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <iterator>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "binary_format.hpp"
+#include "output.hpp"
+#include "proc.hpp"
+#include "region_index.hpp"
+#include "samples.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Writes the samples of a single profile in the binary format, strings are
+ * interned and every one is written only once.
+ */
+struct binary_profile_writer
+{
+    binary_profile_writer(output_stream& output, std::string_view event) : _output(output)
+    {
+        _output.use_binary_format();
+        _output.write(char(binary_record::profile));
+        set_event(event);
+    }
+
+    /**
+     * Samples written from now on were taken on `event`.
+     */
+    void set_event(std::string_view event)
+    {
+        event = event.substr(0, 0xffff);
+        _output.write(char(binary_record::event)).write_le(std::uint16_t(event.size())).write(event);
+    }
+
+    void write(std::uint64_t time, std::uint32_t cpu, std::uint32_t pid, const symbol_t& symbol)
+    {
+        const auto comm = intern(symbol.comm);
+        const auto pathname = intern(symbol.pathname);
+        const auto name = intern(symbol.name);
+
+        _output.write(char(binary_record::sample))
+               .write_le(time)
+               .write_le(std::uint64_t(symbol.addr))
+               .write_le(pid)
+               .write_le(comm)
+               .write_le(pathname)
+               .write_le(name)
+               .write_le(std::uint16_t(cpu));
+    }
+
+private:
+    std::uint32_t intern(std::string_view s)
+    {
+        // longer ones would not fit, they do not occur anyway
+        s = s.substr(0, 0xffff);
+
+        const auto known = _strings.size();
+        const auto id = _strings.intern(s);
+        if (id == known)
+            _output.write(char(binary_record::string)).write_le(std::uint16_t(s.size())).write(s);
+        return id;
+    }
+
+    output_stream& _output;
+    string_table _strings;
+};
+
+/**
+ * Converts the binary profile to the text format, passing it to `f` line by
+ * line, new lines included. A truncated record at the end is ignored.
+ * Returns false when the data is not a binary profile.
+ */
+template<class F>
+bool binary_to_text(std::string_view data, F&& f)
+{
+    if (!is_binary_profile(data))
+        return false;
+    data.remove_prefix(binary_magic.size());
+
+    auto take = [&](auto& value)
+    {
+        if (data.size() < sizeof(value))
+            return false;
+        ::memcpy(&value, data.data(), sizeof(value));
+        data.remove_prefix(sizeof(value));
+        return true;
+    };
+
+    auto take_string = [&](std::string_view& s)
+    {
+        std::uint16_t size;
+        if (!take(size) || data.size() < size)
+            return false;
+        s = data.substr(0, size);
+        data.remove_prefix(size);
+        return true;
+    };
+
+    std::vector<std::string_view> strings;
+    std::string_view event{"-"};
+    auto string = [&](std::uint32_t id) { return id < strings.size() ? strings[id] : std::string_view{"-"}; };
+
+    std::string line;
+    char number[32];
+    auto append_number = [&](std::uint64_t value, int base)
+    {
+        line.append(number, std::to_chars(std::begin(number), std::end(number), value, base).ptr);
+    };
+
+    std::uint8_t type;
+    while (take(type))
+    {
+        line.clear();
+        switch (static_cast<binary_record>(type))
+        {
+            case binary_record::profile:
+            {
+                strings.clear();
+                event = "-";
+                line = samples_format_line;
+                break;
+            }
+            case binary_record::string:
+            {
+                std::string_view s;
+                if (!take_string(s))
+                    return true;
+                strings.push_back(s);
+                continue;
+            }
+            case binary_record::sample:
+            {
+                if (data.size() < binary_sample_size)
+                    return true;
+
+                std::uint64_t time = 0, addr = 0;
+                std::uint32_t pid = 0, comm = 0, pathname = 0, name = 0;
+                std::uint16_t cpu = 0;
+                take(time);
+                take(addr);
+                take(pid);
+                take(comm);
+                take(pathname);
+                take(name);
+                take(cpu);
+
+                append_number(time, 10);
+                line += ';';
+                append_number(cpu, 10);
+                line += ';';
+                append_number(pid, 10);
+                line += ';';
+                line += string(comm);
+                line += ';';
+                line += string(pathname);
+                line += ";0x";
+                append_number(addr, 16);
+                line += ';';
+                line += string(name);
+                line += ';';
+                line += event;
+                line += '\n';
+                break;
+            }
+            case binary_record::event:
+            {
+                if (!take_string(event))
+                    return true;
+                continue;
+            }
+            case binary_record::message:
+            {
+                std::string_view s;
+                if (!take_string(s))
+                    return true;
+                line = "# ";
+                line += s;
+                line += '\n';
+                break;
+            }
+            default:
+                // there is no telling how long an unknown record is
+                return true;
+        }
+        f(std::string_view{line});
+    }
+    return true;
+}
+
+} // namespace
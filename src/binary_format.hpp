@@ -0,0 +1,51 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace poor_perf
+{
+
+/**
+ * Layout of the binary profile, a compact alternative of the text one.
+ *
+ * The file starts with `binary_magic` followed by records, each one being a
+ * u8 type and its body, all numbers are little endian:
+ *
+ *  - profile: no body, starts a new profile, which has its own strings
+ *  - string: u16 size and bytes; strings of a profile get ids from 0 in the
+ *    order they are written, every one before the first sample using it
+ *  - sample: u64 time, u64 addr, u32 pid, u32 comm id, u32 pathname id,
+ *    u32 name id, u16 cpu
+ *  - message: u16 size and bytes of a message line without the leading "# "
+ *  - event: u16 size and bytes of the name of the event the samples which
+ *    follow were taken on, "-" until there is one
+ *
+ * Nothing refers forward, so a file cut short by a crash is readable up to
+ * its last complete record.
+ */
+constexpr std::string_view binary_magic{"PPBIN\x00\x00\x01", 8};
+
+inline bool is_binary_profile(std::string_view data)
+{
+    return data.substr(0, binary_magic.size()) == binary_magic;
+}
+
+enum class binary_record : std::uint8_t
+{
+    profile = 1,
+    string = 2,
+    sample = 3,
+    message = 4,
+    event = 5
+};
+
+constexpr std::size_t binary_sample_size = 8 + 8 + 4 + 4 + 4 + 4 + 2;
+
+} // namespace
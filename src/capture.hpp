@@ -0,0 +1,262 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.hpp"
+#include "perf.hpp"
+#include "proc.hpp"
+#include "sidecar.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Raw perf records along with what is needed to symbolize them, so that a
+ * profile can be replayed offline, without privileges or a PMU.
+ *
+ * It starts with `capture_magic` and continues with records, each one being
+ * a u32 type and a u32 size of the body which follows, all little endian:
+ *
+ *  - kallsyms: contents of /proc/kallsyms
+ *  - process: u32 pid, u16 size and bytes of the comm, then the contents of
+ *    /proc/$PID/maps
+ *  - samples: u32 cpu, u64 sample type, then records as they were read from
+ *    the sampling ring of that cpu
+ *  - tracking: u32 cpu, then records as they were read from the process
+ *    tracking ring of that cpu
+ *  - event: name of the event the samples were taken on
+ */
+constexpr std::string_view capture_magic{"PPRAW\x00\x00\x01", 8};
+
+enum class capture_record : std::uint32_t
+{
+    kallsyms = 1,
+    process = 2,
+    samples = 3,
+    tracking = 4,
+    event = 5
+};
+
+/**
+ * Writes a capture, records can be added from many threads.
+ */
+struct capture_writer
+{
+    /**
+     * Whatever was at `path` is replaced.
+     */
+    explicit capture_writer(const std::string& path) : _output{removed(path)}
+    {
+        _output.write(capture_magic);
+    }
+
+    /**
+     * Kernel symbols and processes as they are right now.
+     */
+    void snapshot()
+    {
+        add(capture_record::kallsyms, read_file("/proc/kallsyms", 1 << 20));
+
+        for (auto pid : list_pids())
+        {
+            const auto dir = "/proc/" + std::to_string(pid);
+            std::string body;
+            try
+            {
+                detail::append(body, pid);
+                detail::append_bytes(body, read_first_line(dir + "/comm"));
+                body += read_file(dir + "/maps");
+            }
+            catch (const std::exception&)
+            {
+                // it exited meanwhile
+                continue;
+            }
+            add(capture_record::process, body);
+        }
+    }
+
+    void samples(std::uint32_t cpu, std::uint64_t sample_type, std::string_view records)
+    {
+        std::string body;
+        detail::append(body, cpu);
+        detail::append(body, sample_type);
+        body += records;
+        add(capture_record::samples, body);
+    }
+
+    void tracking(std::uint32_t cpu, std::string_view records)
+    {
+        std::string body;
+        detail::append(body, cpu);
+        body += records;
+        add(capture_record::tracking, body);
+    }
+
+    void event(std::string_view name)
+    {
+        add(capture_record::event, name);
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _output.flush();
+    }
+
+private:
+    static const std::string& removed(const std::string& path)
+    {
+        ::unlink(path.c_str());
+        return path;
+    }
+
+    void add(capture_record type, std::string_view body)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _output.write_le(static_cast<std::uint32_t>(type)).write_le(static_cast<std::uint32_t>(body.size())).write(body);
+    }
+
+    std::mutex _mutex;
+    output_stream _output;
+};
+
+/**
+ * Contents of a capture as they are read back, records of every ring are
+ * put together in the order they were read.
+ */
+struct capture_contents
+{
+    std::string kallsyms;
+    std::vector<scanned_process> processes;
+
+    // older captures do not have it
+    std::string event{"-"};
+
+    struct sampling_ring
+    {
+        std::uint64_t sample_type = 0;
+        std::string records;
+    };
+
+    std::map<std::uint32_t, sampling_ring> samples;
+    std::map<std::uint32_t, std::string> tracking;
+};
+
+/**
+ * Reads what was written by `capture_writer`, a truncated record at the end
+ * is ignored.
+ */
+inline capture_contents read_capture(const std::string& path)
+{
+    using namespace detail;
+
+    const auto contents = read_file(path, 1 << 20);
+    std::string_view in{contents};
+
+    if (in.substr(0, capture_magic.size()) != capture_magic)
+        throw std::runtime_error{"'" + path + "' is not a capture"};
+    in.remove_prefix(capture_magic.size());
+
+    capture_contents ret;
+    std::uint32_t type, size;
+    while (take(in, type) && take(in, size) && in.size() >= size)
+    {
+        auto body = in.substr(0, size);
+        in.remove_prefix(size);
+
+        switch (static_cast<capture_record>(type))
+        {
+            case capture_record::kallsyms:
+            {
+                ret.kallsyms = body;
+                break;
+            }
+            case capture_record::process:
+            {
+                scanned_process process;
+                if (!take(body, process.pid) || !take_bytes(body, process.comm))
+                    break;
+                process.maps = parse_maps(body);
+                ret.processes.push_back(std::move(process));
+                break;
+            }
+            case capture_record::samples:
+            {
+                std::uint32_t cpu;
+                std::uint64_t sample_type;
+                if (!take(body, cpu) || !take(body, sample_type))
+                    break;
+                auto& ring = ret.samples[cpu];
+                ring.sample_type = sample_type;
+                ring.records += body;
+                break;
+            }
+            case capture_record::tracking:
+            {
+                std::uint32_t cpu;
+                if (!take(body, cpu))
+                    break;
+                ret.tracking[cpu] += body;
+                break;
+            }
+            case capture_record::event:
+            {
+                ret.event = body;
+                break;
+            }
+            default:
+                // unknown records are skipped, they may come from a newer version
+                break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Records laid out in a ring of their own, as if the kernel had just
+ * written them, so they are read by the very same `ring_reader`.
+ */
+struct replayed_ring
+{
+    explicit replayed_ring(std::string_view records)
+    {
+        std::size_t size = 8;
+        while (size < records.size())
+            size *= 2;
+
+        _data.resize(size);
+        records.copy(_data.data(), records.size());
+        _metadata.data_head = records.size();
+        _reader = std::make_unique<ring_reader>(&_metadata, _data.data(), _data.size());
+    }
+
+    replayed_ring(const replayed_ring&) = delete;
+    replayed_ring& operator=(const replayed_ring&) = delete;
+
+    ring_reader& reader()
+    {
+        return *_reader;
+    }
+
+private:
+    perf_event_mmap_page _metadata{};
+    std::vector<char> _data;
+    std::unique_ptr<ring_reader> _reader;
+};
+
+} // namespace
@@ -0,0 +1,187 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "utils.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Gzip stream written to a file descriptor, compressed by a thread of its
+ * own so the one writing the profile only copies its buffers.
+ *
+ * Every block is flushed as it is compressed, everything handed over so far
+ * can be decompressed even when the stream is never finished. When the
+ * compression falls behind, `write` waits for a free block.
+ */
+struct gzip_compressor
+{
+    constexpr static std::size_t blocks = 4;
+
+    explicit gzip_compressor(int fd) : _fd(fd), _output(1 << 16)
+    {
+        _stream = {};
+        // 16 more window bits ask for a gzip header instead of the zlib one
+        if (::deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error{"could not initialize compression"};
+
+        for (std::size_t i = 0; i < blocks; i++)
+            _free.emplace_back();
+
+        _thread = std::thread{[this] { run(); }};
+    }
+
+    gzip_compressor(const gzip_compressor&) = delete;
+    gzip_compressor& operator=(const gzip_compressor&) = delete;
+
+    /**
+     * Compresses what is left and finishes the stream.
+     */
+    ~gzip_compressor()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stopping = true;
+        }
+        _changed.notify_all();
+        _thread.join();
+        ::deflateEnd(&_stream);
+    }
+
+    void write(const char* data, std::size_t size)
+    {
+        std::vector<char> block;
+        {
+            std::unique_lock<std::mutex> lock{_mutex};
+            _changed.wait(lock, [this] { return !_free.empty(); });
+            block = std::move(_free.front());
+            _free.pop_front();
+        }
+
+        block.assign(data, data + size);
+
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _pending.push_back(std::move(block));
+        }
+        _changed.notify_all();
+    }
+
+private:
+    void run()
+    {
+        // it inherits the scheduling of whoever opened the output
+        set_this_thread_name("poor-compress");
+        set_this_thread_into_normal();
+
+        std::unique_lock<std::mutex> lock{_mutex};
+        while (true)
+        {
+            _changed.wait(lock, [this] { return _stopping || !_pending.empty(); });
+            if (_pending.empty())
+                break;
+
+            auto block = std::move(_pending.front());
+            _pending.pop_front();
+
+            lock.unlock();
+            deflate(block.data(), block.size(), Z_SYNC_FLUSH);
+            lock.lock();
+
+            _free.push_back(std::move(block));
+            _changed.notify_all();
+        }
+        lock.unlock();
+
+        deflate(nullptr, 0, Z_FINISH);
+    }
+
+    void deflate(const char* data, std::size_t size, int flush)
+    {
+        _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        _stream.avail_in = static_cast<uInt>(size);
+        do
+        {
+            _stream.next_out = reinterpret_cast<Bytef*>(_output.data());
+            _stream.avail_out = static_cast<uInt>(_output.size());
+            ::deflate(&_stream, flush);
+            write_all(_fd, _output.data(), _output.size() - _stream.avail_out);
+        }
+        while (_stream.avail_out == 0);
+    }
+
+    int _fd;
+    z_stream _stream;
+    std::vector<char> _output;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<std::vector<char>> _pending;
+    std::deque<std::vector<char>> _free;
+    bool _stopping = false;
+    std::thread _thread;
+};
+
+inline bool is_gzip(std::string_view data)
+{
+    return data.size() >= 2 && data[0] == '\x1f' && data[1] == '\x8b';
+}
+
+/**
+ * Decompresses the gzip members one after another, like zcat does with the
+ * appended profiles, up to `limit` bytes. A stream which was cut short, like
+ * the one of a profiler which crashed, is decompressed as far as it goes.
+ * Throws when there is nothing to decompress at all.
+ */
+inline std::string gunzip(std::string_view data, std::size_t limit = std::numeric_limits<std::size_t>::max())
+{
+    z_stream stream{};
+    if (::inflateInit2(&stream, 15 + 16) != Z_OK)
+        throw std::runtime_error{"could not initialize decompression"};
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+
+    std::string ret;
+    int status = Z_OK;
+    while (ret.size() < limit)
+    {
+        const auto size = ret.size();
+        ret.resize(std::min(limit, std::max<std::size_t>(size * 2, 1 << 16)));
+        stream.next_out = reinterpret_cast<Bytef*>(&ret[size]);
+        stream.avail_out = static_cast<uInt>(ret.size() - size);
+
+        status = ::inflate(&stream, Z_NO_FLUSH);
+        ret.resize(ret.size() - stream.avail_out);
+
+        if (status == Z_STREAM_END && stream.avail_in >= 2 && stream.next_in[0] == 0x1f && stream.next_in[1] == 0x8b)
+            status = ::inflateReset(&stream);
+        else if (status != Z_OK)
+            break;
+    }
+    ::inflateEnd(&stream);
+
+    if (ret.empty() && status != Z_STREAM_END && status != Z_BUF_ERROR)
+        throw std::runtime_error{"data is not compressed with gzip"};
+    return ret;
+}
+
+} // namespace
@@ -0,0 +1,364 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "event_loop.hpp"
+#include "parse.hpp"
+#include "utils.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Line sent over the control socket: a command followed by `key=value`
+ * arguments separated by spaces, like "start cpu=0-3 duration=2 output=-".
+ */
+struct control_request
+{
+    std::string command;
+    std::map<std::string, std::string> args;
+};
+
+inline control_request parse_control_request(std::string_view line)
+{
+    control_request ret;
+    ret.command = next_field(line);
+
+    while (true)
+    {
+        auto arg = next_field(line);
+        if (arg.empty())
+            break;
+
+        auto eq = arg.find('=');
+        if (eq == std::string_view::npos)
+            ret.args.emplace(arg, "");
+        else
+            ret.args.emplace(arg.substr(0, eq), arg.substr(eq + 1));
+    }
+    return ret;
+}
+
+/**
+ * Connection of a control client, it is never waited for. Requests are read
+ * when the event loop says there is something to read. Replies, and a
+ * profile streamed to the client, are written right away as far as the
+ * socket takes them, the rest is kept until the loop says it is writable.
+ *
+ * The descriptor is in the loop edge triggered, so every event is handled
+ * until the socket would block.
+ */
+struct control_client
+{
+    // lines longer than this are cut off
+    constexpr static std::size_t max_line = 4096;
+
+    // what may wait for a client which does not read, it fails beyond that
+    constexpr static std::size_t max_outgoing = 4 << 20;
+
+    constexpr static std::uint32_t events = EPOLLIN | EPOLLOUT | EPOLLET;
+
+    explicit control_client(int fd) : _fd(fd)
+    {
+    }
+
+    control_client(const control_client&) = delete;
+    control_client& operator=(const control_client&) = delete;
+
+    ~control_client()
+    {
+        ::close(_fd);
+    }
+
+    int fd() const
+    {
+        return _fd;
+    }
+
+    /**
+     * Passes complete lines which have arrived to `f`, returns false when
+     * the client hung up.
+     */
+    template<class F>
+    bool read(F&& f)
+    {
+        while (true)
+        {
+            char buffer[1024];
+            auto n = ::read(_fd, buffer, sizeof(buffer));
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            if (n <= 0)
+                return false;
+
+            _pending.append(buffer, n);
+
+            std::size_t eol;
+            while ((eol = _pending.find('\n')) != std::string::npos)
+            {
+                auto line = _pending.substr(0, eol);
+                _pending.erase(0, eol + 1);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                f(std::string_view{line});
+            }
+
+            if (_pending.size() > max_line)
+                _pending.clear();
+        }
+    }
+
+    /**
+     * Sends the text, or keeps what the socket did not take for later. Can
+     * be called from any thread, returns false once the client has failed.
+     */
+    bool reply(std::string_view text)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_failed)
+            return false;
+
+        _outgoing.append(text);
+        send_some();
+
+        if (_outgoing.size() > max_outgoing)
+            fail();
+        return !_failed;
+    }
+
+    /**
+     * Sends what was kept, to be called when the socket is writable.
+     */
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        send_some();
+    }
+
+    /**
+     * Whether something is still to be sent.
+     */
+    bool sending() const
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return !_outgoing.empty();
+    }
+
+    /**
+     * The client hung up or fell too far behind, nothing is sent to it
+     * anymore.
+     */
+    bool failed() const
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _failed;
+    }
+
+private:
+    void send_some()
+    {
+        std::size_t sent = 0;
+        while (sent < _outgoing.size())
+        {
+            auto n = ::send(_fd, _outgoing.data() + sent, _outgoing.size() - sent, MSG_NOSIGNAL);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0)
+            {
+                fail();
+                return;
+            }
+            sent += n;
+        }
+        _outgoing.erase(0, sent);
+    }
+
+    void fail()
+    {
+        _failed = true;
+        _outgoing.clear();
+        _outgoing.shrink_to_fit();
+    }
+
+    int _fd;
+    std::string _pending;
+
+    mutable std::mutex _mutex;
+    std::string _outgoing;
+    bool _failed = false;
+};
+
+/**
+ * Unix domain socket which takes commands, one per line, from any number
+ * of clients. Only root can connect as the profiles show every process.
+ *
+ * Clients are shared, so a client a profile is streamed to stays open for
+ * as long as the profile needs it, even when it has hung up meanwhile. A
+ * client which is disconnected while something is still to be sent to it
+ * is closed once it was sent.
+ */
+struct control_server
+{
+    explicit control_server(const std::string& path) : _path(path)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error{"control socket path '" + path + "' is too long"};
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+        _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_fd == -1)
+            throw std::runtime_error{"could not create control socket"};
+
+        // do not care about errors here
+        ::unlink(path.c_str());
+
+        if (::bind(_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1 ||
+            ::chmod(path.c_str(), 0600) == -1 || ::listen(_fd, 8) == -1)
+        {
+            ::close(_fd);
+            throw std::runtime_error{"could not listen on control socket '" + path + "'"};
+        }
+    }
+
+    control_server(const control_server&) = delete;
+    control_server& operator=(const control_server&) = delete;
+
+    ~control_server()
+    {
+        ::close(_fd);
+        ::unlink(_path.c_str());
+    }
+
+    const std::string& path() const
+    {
+        return _path;
+    }
+
+    /**
+     * Makes the loop wait for new clients, for commands of the connected
+     * ones and for all of them to take what is sent to them.
+     */
+    void add_to(event_loop& loop)
+    {
+        loop.add_fd(_fd);
+        for (const auto& client : _clients)
+            loop.add_fd(client->fd(), control_client::events);
+        for (const auto& client : _closing)
+            loop.add_fd(client->fd(), control_client::events);
+    }
+
+    /**
+     * Handles the event of the loop if `fd` belongs to the server, passing
+     * every request to `f` along with its client. Returns false when it is
+     * somebody else's.
+     */
+    template<class F>
+    bool handle(event_loop& loop, int fd, F&& f)
+    {
+        if (fd == _fd)
+        {
+            int client;
+            while ((client = ::accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+            {
+                _clients.push_back(std::make_shared<control_client>(client));
+                loop.add_fd(client, control_client::events);
+            }
+            return true;
+        }
+
+        auto has_fd = [fd](const auto& c) { return c->fd() == fd; };
+
+        auto closing = std::find_if(_closing.begin(), _closing.end(), has_fd);
+        if (closing != _closing.end())
+        {
+            auto& client = *closing;
+            client->flush();
+            if (!client->sending() || client->failed())
+            {
+                loop.remove_fd(fd);
+                _closing.erase(closing);
+            }
+            return true;
+        }
+
+        auto it = std::find_if(_clients.begin(), _clients.end(), has_fd);
+        if (it == _clients.end())
+            return false;
+
+        // the client may go away while its requests are handled
+        auto client = *it;
+        client->flush();
+        if (!client->read([&](std::string_view line) { f(client, parse_control_request(line)); }) || client->failed())
+        {
+            disconnect(client);
+            if (std::find(_closing.begin(), _closing.end(), client) == _closing.end())
+                loop.remove_fd(fd);
+        }
+        return true;
+    }
+
+    /**
+     * Forgets the client, it is closed once nobody uses it and everything
+     * was sent to it.
+     */
+    void disconnect(const std::shared_ptr<control_client>& client)
+    {
+        auto it = std::find(_clients.begin(), _clients.end(), client);
+        if (it == _clients.end())
+            return;
+
+        _clients.erase(it);
+        if (client->sending() && !client->failed())
+            _closing.push_back(client);
+    }
+
+    /**
+     * Whether the client is still connected.
+     */
+    bool connected(const std::shared_ptr<control_client>& client) const
+    {
+        return std::find(_clients.begin(), _clients.end(), client) != _clients.end();
+    }
+
+    auto clients() const
+    {
+        return _clients.size();
+    }
+
+private:
+    std::string _path;
+    int _fd;
+    std::vector<std::shared_ptr<control_client>> _clients;
+
+    // disconnected ones which are still being sent to
+    std::vector<std::shared_ptr<control_client>> _closing;
+};
+
+} // namespace
@@ -0,0 +1,145 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace poor_perf
+{
+
+/**
+ * Set of cpus in the format used by the kernel in /sys/devices/system/cpu/online,
+ * e.g. "0", "1,3" or "0-3,8-11". Additionally "all" means every online cpu.
+ */
+struct cpu_list
+{
+    std::vector<std::size_t> cpus;
+
+    auto begin() const
+    {
+        return cpus.begin();
+    }
+
+    auto end() const
+    {
+        return cpus.end();
+    }
+
+    auto size() const
+    {
+        return cpus.size();
+    }
+};
+
+inline std::size_t parse_cpu_number(const std::string& s)
+{
+    if (s.empty() || !std::all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        throw std::runtime_error{"invalid cpu number '" + s + "'"};
+    return std::stoul(s);
+}
+
+inline cpu_list online_cpus();
+
+inline cpu_list parse_cpu_list(const std::string& s)
+{
+    if (s == "all")
+        return online_cpus();
+
+    cpu_list ret;
+    std::size_t pos = 0;
+    while (pos <= s.size())
+    {
+        auto comma = std::min(s.find(',', pos), s.size());
+        auto item = s.substr(pos, comma - pos);
+        auto dash = item.find('-');
+
+        if (dash == std::string::npos)
+            ret.cpus.push_back(parse_cpu_number(item));
+        else
+        {
+            auto first = parse_cpu_number(item.substr(0, dash));
+            auto last = parse_cpu_number(item.substr(dash + 1));
+            if (first > last)
+                throw std::runtime_error{"invalid cpu range '" + item + "'"};
+            for (auto cpu = first; cpu <= last; cpu++)
+                ret.cpus.push_back(cpu);
+        }
+
+        pos = comma + 1;
+    }
+
+    std::sort(ret.cpus.begin(), ret.cpus.end());
+    ret.cpus.erase(std::unique(ret.cpus.begin(), ret.cpus.end()), ret.cpus.end());
+    return ret;
+}
+
+inline cpu_list online_cpus()
+{
+    std::ifstream f{"/sys/devices/system/cpu/online"};
+    std::string line;
+    if (!std::getline(f, line))
+        throw std::runtime_error{"could not read the list of online cpus"};
+    return parse_cpu_list(line);
+}
+
+/**
+ * Cpus from `cpus` which are not in `excluded`.
+ */
+inline cpu_list except(const cpu_list& cpus, const cpu_list& excluded)
+{
+    cpu_list ret;
+    std::set_difference(cpus.begin(), cpus.end(), excluded.begin(), excluded.end(), std::back_inserter(ret.cpus));
+    return ret;
+}
+
+inline std::istream& operator>>(std::istream& is, cpu_list& cpus)
+{
+    std::string s;
+    is >> s;
+
+    try
+    {
+        cpus = parse_cpu_list(s);
+    }
+    catch (const std::exception&)
+    {
+        is.setstate(std::ios_base::failbit);
+    }
+
+    return is;
+}
+
+/**
+ * Prints the list back in its compact form, consecutive cpus are folded into ranges.
+ */
+inline std::ostream& operator<<(std::ostream& os, const cpu_list& cpus)
+{
+    const auto& v = cpus.cpus;
+    for (std::size_t i = 0; i < v.size();)
+    {
+        auto j = i;
+        while (j + 1 < v.size() && v[j + 1] == v[j] + 1)
+            j++;
+
+        if (i)
+            os << ',';
+        os << v[i];
+        if (j != i)
+            os << '-' << v[j];
+
+        i = j + 1;
+    }
+    return os;
+}
+
+} // namespace
@@ -0,0 +1,456 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace poor_perf
+{
+
+/**
+ * Read only mapping of a whole file.
+ */
+struct mapped_file
+{
+    explicit mapped_file(const std::string& path)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error{"could not open '" + path + "'"};
+
+        struct stat st;
+        if (::fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        {
+            ::close(fd);
+            throw std::runtime_error{"'" + path + "' is not a regular file"};
+        }
+
+        _size = st.st_size;
+        _dev = st.st_dev;
+        _inode = st.st_ino;
+        auto data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+            throw std::runtime_error{"could not map '" + path + "'"};
+        _data = static_cast<const char*>(data);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file()
+    {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+
+    const char* data() const
+    {
+        return _data;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    std::uint64_t dev() const
+    {
+        return _dev;
+    }
+
+    std::uint64_t inode() const
+    {
+        return _inode;
+    }
+
+    /**
+     * Copies an object from `offset`, throws when it is not within the file.
+     */
+    template<class T>
+    T read(std::uint64_t offset) const
+    {
+        if (offset > _size || _size - offset < sizeof(T))
+            throw std::runtime_error{"truncated elf file"};
+
+        T ret;
+        ::memcpy(&ret, _data + offset, sizeof(T));
+        return ret;
+    }
+
+private:
+    const char* _data;
+    std::size_t _size;
+    std::uint64_t _dev;
+    std::uint64_t _inode;
+};
+
+/**
+ * Function symbols of a 64 bit ELF file from .symtab and .dynsym, along with
+ * what is needed to find them by an offset in the file, which is what the
+ * samples refer to, and the GNU build-id.
+ *
+ * Only what is needed is copied out of the file, it is not kept open.
+ */
+struct elf_symbols
+{
+    /**
+     * Loadable segment, it maps the file offsets to addresses of symbols.
+     */
+    struct segment
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint64_t vaddr;
+    };
+
+    explicit elf_symbols(const std::string& path)
+    {
+        mapped_file file{path};
+        _dev = file.dev();
+        _inode = file.inode();
+
+        auto ehdr = file.read<Elf64_Ehdr>(0);
+        if (::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+            ehdr.e_ident[EI_DATA] != ELFDATA2LSB)
+            throw std::runtime_error{"'" + path + "' is not a 64 bit little endian elf file"};
+
+        for (std::size_t i = 0; i < ehdr.e_phnum; i++)
+        {
+            auto phdr = file.read<Elf64_Phdr>(ehdr.e_phoff + i * ehdr.e_phentsize);
+            if (phdr.p_type == PT_LOAD)
+                _segments.push_back({phdr.p_offset, phdr.p_filesz, phdr.p_vaddr});
+            else if (phdr.p_type == PT_NOTE && _build_id.empty())
+                read_build_id(file, phdr.p_offset, phdr.p_filesz);
+        }
+
+        std::vector<Elf64_Shdr> sections;
+        for (std::size_t i = 0; i < ehdr.e_shnum; i++)
+            sections.push_back(file.read<Elf64_Shdr>(ehdr.e_shoff + i * ehdr.e_shentsize));
+
+        struct parsed
+        {
+            std::uint64_t addr;
+            std::uint64_t size;
+            std::uint32_t name;
+        };
+
+        std::vector<parsed> symbols;
+        std::unordered_map<std::string_view, std::uint32_t> names;
+
+        for (const auto& section : sections)
+        {
+            if ((section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) || section.sh_link >= sections.size() ||
+                section.sh_entsize < sizeof(Elf64_Sym))
+                continue;
+
+            const auto& strtab = sections[section.sh_link];
+            if (strtab.sh_offset > file.size() || file.size() - strtab.sh_offset < strtab.sh_size)
+                continue;
+            const std::string_view strings{file.data() + strtab.sh_offset, strtab.sh_size};
+
+            for (std::uint64_t i = 0; i < section.sh_size / section.sh_entsize; i++)
+            {
+                auto sym = file.read<Elf64_Sym>(section.sh_offset + i * section.sh_entsize);
+                auto type = ELF64_ST_TYPE(sym.st_info);
+
+                if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx == SHN_UNDEF || sym.st_value == 0 ||
+                    sym.st_name >= strings.size())
+                    continue;
+
+                auto name = strings.substr(sym.st_name);
+                name = name.substr(0, name.find('\0'));
+
+                // .symtab and .dynsym share most of the names
+                auto it = names.emplace(name, static_cast<std::uint32_t>(_names.size())).first;
+                if (it->second == _names.size())
+                {
+                    _names.append(name);
+                    _names.push_back('\0');
+                }
+
+                symbols.push_back({sym.st_value, sym.st_size, it->second});
+            }
+        }
+
+        // one symbol per address, the ones with a size win
+        std::sort(symbols.begin(), symbols.end(), [](const auto& a, const auto& b)
+        {
+            return a.addr != b.addr ? a.addr < b.addr : a.size > b.size;
+        });
+        symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const auto& a, const auto& b)
+        {
+            return a.addr == b.addr;
+        }), symbols.end());
+
+        _addrs.reserve(symbols.size());
+        _sizes.reserve(symbols.size());
+        _name_offsets.reserve(symbols.size());
+        for (const auto& s : symbols)
+        {
+            _addrs.push_back(s.addr);
+            _sizes.push_back(s.size);
+            _name_offsets.push_back(s.name);
+        }
+    }
+
+    elf_symbols(const elf_symbols&) = delete;
+    elf_symbols& operator=(const elf_symbols&) = delete;
+
+    /**
+     * Name of the function at `offset` in the file, demangled, or an empty
+     * string when there is no such function.
+     */
+    std::string_view find(std::uint64_t offset) const
+    {
+        auto segment = std::find_if(_segments.begin(), _segments.end(), [offset](const auto& s)
+        {
+            return offset >= s.offset && offset - s.offset < s.size;
+        });
+        if (segment == _segments.end())
+            return {};
+
+        const auto addr = offset - segment->offset + segment->vaddr;
+        auto it = std::upper_bound(_addrs.begin(), _addrs.end(), addr);
+        if (it == _addrs.begin())
+            return {};
+
+        const auto i = std::distance(_addrs.begin(), it) - 1;
+
+        // symbols without a size are assumed to last until the next one
+        if (_sizes[i] && addr - _addrs[i] >= _sizes[i])
+            return {};
+
+        return demangled(i);
+    }
+
+    /**
+     * Raw bytes of the GNU build-id, empty when the file has none.
+     */
+    const std::string& build_id() const
+    {
+        return _build_id;
+    }
+
+    std::uint64_t dev() const
+    {
+        return _dev;
+    }
+
+    std::uint64_t inode() const
+    {
+        return _inode;
+    }
+
+    const std::vector<segment>& segments() const
+    {
+        return _segments;
+    }
+
+    auto size() const
+    {
+        return _addrs.size();
+    }
+
+private:
+    void read_build_id(const mapped_file& file, std::uint64_t offset, std::uint64_t size)
+    {
+        const auto end = offset + size;
+        while (offset + sizeof(Elf64_Nhdr) <= end)
+        {
+            auto note = file.read<Elf64_Nhdr>(offset);
+            offset += sizeof(note);
+
+            const auto name = offset;
+            const auto desc = name + ((note.n_namesz + 3) & ~3u);
+            offset = desc + ((note.n_descsz + 3) & ~3u);
+
+            if (note.n_type != NT_GNU_BUILD_ID || note.n_namesz != 4 || desc + note.n_descsz > file.size() ||
+                ::memcmp(file.data() + name, "GNU", 4) != 0)
+                continue;
+
+            _build_id.assign(file.data() + desc, note.n_descsz);
+            return;
+        }
+    }
+
+    /**
+     * C++ names are demangled the first time they are asked for, it is too
+     * expensive for all of them.
+     */
+    std::string_view demangled(std::size_t i) const
+    {
+        const char* name = _names.data() + _name_offsets[i];
+        if (::strncmp(name, "_Z", 2) != 0)
+            return name;
+
+        auto it = _demangled.find(i);
+        if (it == _demangled.end())
+        {
+            int status = 0;
+            char* s = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+            it = _demangled.emplace(i, status == 0 && s ? s : name).first;
+            std::free(s);
+        }
+        return it->second;
+    }
+
+    std::uint64_t _dev;
+    std::uint64_t _inode;
+    std::vector<segment> _segments;
+    std::string _build_id;
+
+    std::vector<std::uint64_t> _addrs;
+    std::vector<std::uint64_t> _sizes;
+    std::vector<std::uint32_t> _name_offsets;
+
+    // names separated by NULs
+    std::string _names;
+    mutable std::unordered_map<std::size_t, std::string> _demangled;
+};
+
+/**
+ * Parsed symbols of every file which was asked for, kept for the lifetime
+ * of the profiler, so they are not parsed again on the next trigger.
+ *
+ * Files are told apart by the device and inode of the mapping, so a binary
+ * which was replaced since it was mapped is never symbolized with the new
+ * one. Regions whose file is not known are looked up by their path, only
+ * once until `forget_paths` is called.
+ */
+struct elf_symbol_cache
+{
+    /**
+     * Symbols of the file with `dev` and `inode` which process `pid` mapped
+     * at [start, end) from `path`. When the path refers to another file now,
+     * the mapped one is read through /proc/$PID/map_files, which is there
+     * while the process lives even if the file was deleted. nullptr when the
+     * file cannot be read that way or it is not an ELF file.
+     */
+    const elf_symbols* get(std::uint64_t dev, std::uint64_t inode, const std::string& path, std::uint32_t pid,
+        std::uintptr_t start, std::uintptr_t end)
+    {
+        // an empty entry is kept for files which failed so they are not tried again
+        auto [it, inserted] = _by_file.try_emplace({dev, inode});
+        if (inserted)
+            it->second = load(dev, inode, path, pid, start, end);
+        return it->second.get();
+    }
+
+    /**
+     * Symbols of the file at `path`, whose `id` is a small number unique to
+     * it like the one from `string_table`. nullptr when the file cannot be
+     * read or it is not an ELF file.
+     */
+    const elf_symbols* get(std::uint32_t id, const std::string& path)
+    {
+        if (id >= _by_id.size())
+            _by_id.resize(id + 1);
+
+        auto& entry = _by_id[id];
+        if (!entry.looked_up)
+        {
+            entry.symbols = load(path);
+            entry.looked_up = true;
+        }
+        return entry.symbols;
+    }
+
+    /**
+     * Paths will be looked up again, whatever was parsed is reused when
+     * they refer to the same files. Files which failed are tried again, the
+     * next process which maps them might still be there to read them from.
+     */
+    void forget_paths()
+    {
+        _by_id.clear();
+        for (auto it = _by_file.begin(); it != _by_file.end();)
+            it = it->second ? std::next(it) : _by_file.erase(it);
+    }
+
+    auto size() const
+    {
+        return _by_file.size();
+    }
+
+private:
+    std::unique_ptr<elf_symbols> load(std::uint64_t dev, std::uint64_t inode, const std::string& path,
+        std::uint32_t pid, std::uintptr_t start, std::uintptr_t end)
+    {
+        // maps list also things like [vdso] or anonymous memory
+        if (path.empty() || path[0] != '/')
+            return nullptr;
+
+        struct stat st;
+        const auto same = ::stat(path.c_str(), &st) == 0 && st.st_dev == dev && st.st_ino == inode;
+
+        char mapped[64];
+        std::snprintf(mapped, sizeof(mapped), "/proc/%u/map_files/%lx-%lx", unsigned(pid), (unsigned long)start,
+            (unsigned long)end);
+
+        try
+        {
+            return std::make_unique<elf_symbols>(same ? path : std::string{mapped});
+        }
+        catch (const std::exception&)
+        {
+            return nullptr;
+        }
+    }
+
+    const elf_symbols* load(const std::string& path)
+    {
+        if (path.empty() || path[0] != '/')
+            return nullptr;
+
+        struct stat st;
+        if (::stat(path.c_str(), &st) == -1)
+            return nullptr;
+
+        auto [it, inserted] = _by_file.try_emplace({st.st_dev, st.st_ino});
+        if (inserted)
+        {
+            try
+            {
+                it->second = std::make_unique<elf_symbols>(path);
+            }
+            catch (const std::exception&)
+            {
+            }
+        }
+        return it->second.get();
+    }
+
+    struct path_entry
+    {
+        bool looked_up = false;
+        const elf_symbols* symbols = nullptr;
+    };
+
+    std::vector<path_entry> _by_id;
+    std::map<std::pair<std::uint64_t, std::uint64_t>, std::unique_ptr<elf_symbols>> _by_file;
+};
+
+} // namespace
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <queue>
 
 #include <signal.h>
@@ -23,16 +24,25 @@ struct event_loop
             throw std::runtime_error{"could not create epoll instance"};
     }
 
-    void add_fd(int fd)
+    /**
+     * `events` are EPOLLIN for most descriptors, EPOLLPRI for the ones like
+     * PSI triggers.
+     */
+    void add_fd(int fd, std::uint32_t events = EPOLLIN)
     {
         epoll_event ev;
-        ev.events = EPOLLIN;
+        ev.events = events;
         ev.data.fd = fd;
         auto ret = epoll_ctl(_fd, EPOLL_CTL_ADD, fd, &ev);
         if (ret)
             throw std::runtime_error{"could not add descriptor to epoll wait list"};
     }
 
+    void remove_fd(int fd)
+    {
+        ::epoll_ctl(_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
     template<class F>
     bool run_once(F&& f, std::chrono::milliseconds timeout = std::chrono::milliseconds{-1})
     {
@@ -0,0 +1,200 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+
+#include "parse.hpp"
+
+namespace poor_perf
+{
+
+// in Hz, of the profiles
+constexpr std::uint64_t default_sampling_frequency = 7000;
+
+/**
+ * Event which is sampled or counted, along with the name it was given.
+ */
+struct perf_event_spec
+{
+    std::string name;
+    std::uint32_t type = PERF_TYPE_SOFTWARE;
+    std::uint64_t config = PERF_COUNT_SW_CPU_CLOCK;
+
+    bool hardware() const
+    {
+        return type == PERF_TYPE_HARDWARE;
+    }
+
+    bool tracepoint() const
+    {
+        return type == PERF_TYPE_TRACEPOINT;
+    }
+};
+
+inline perf_event_spec cycles_event()
+{
+    return {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+}
+
+/**
+ * Timer based event which is there even without hardware counters.
+ */
+inline perf_event_spec cpu_clock_event()
+{
+    return {"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK};
+}
+
+/**
+ * Where the kernel lists its tracepoints, tracefs or the older debugfs one.
+ */
+inline const std::vector<std::string>& tracing_dirs()
+{
+    static const std::vector<std::string> dirs{"/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+    return dirs;
+}
+
+/**
+ * Event by the name perf gives it, tracepoints are named "subsystem:event",
+ * like "sched:sched_switch", and their ids are looked up in `dirs`.
+ */
+inline perf_event_spec parse_event(const std::string& name, const std::vector<std::string>& dirs = tracing_dirs())
+{
+    static const perf_event_spec known[] = {
+        cycles_event(),
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        cpu_clock_event(),
+        {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    };
+
+    for (const auto& event : known)
+        if (event.name == name)
+            return event;
+
+    const auto colon = name.find(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == name.size() ||
+        name.find_first_of("/.") != std::string::npos)
+        throw std::runtime_error{"unknown event '" + name + "'"};
+
+    const auto path = "/events/" + name.substr(0, colon) + "/" + name.substr(colon + 1) + "/id";
+    for (const auto& dir : dirs)
+    {
+        const auto id = read_file(dir + path, 64);
+        if (id.empty())
+            continue;
+
+        std::string_view s{id};
+        return {name, PERF_TYPE_TRACEPOINT, parse_dec(s)};
+    }
+    throw std::runtime_error{"unknown tracepoint '" + name + "', is tracefs mounted?"};
+}
+
+/**
+ * Events separated by commas, e.g. "cycles,instructions,cache-misses". The
+ * first one is sampled, the others are counted in its group.
+ */
+struct event_list
+{
+    std::vector<perf_event_spec> events{cycles_event()};
+
+    const perf_event_spec& sampled() const
+    {
+        return events.front();
+    }
+
+    auto begin() const
+    {
+        return events.begin();
+    }
+
+    auto end() const
+    {
+        return events.end();
+    }
+
+    auto size() const
+    {
+        return events.size();
+    }
+};
+
+inline event_list parse_event_list(const std::string& s)
+{
+    event_list ret;
+    ret.events.clear();
+
+    std::size_t pos = 0;
+    while (pos <= s.size())
+    {
+        auto comma = std::min(s.find(',', pos), s.size());
+        ret.events.push_back(parse_event(s.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+    return ret;
+}
+
+inline std::istream& operator>>(std::istream& is, event_list& events)
+{
+    std::string s;
+    is >> s;
+
+    try
+    {
+        events = parse_event_list(s);
+    }
+    catch (const std::exception&)
+    {
+        is.setstate(std::ios_base::failbit);
+    }
+
+    return is;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const event_list& events)
+{
+    for (std::size_t i = 0; i < events.size(); i++)
+        os << (i ? "," : "") << events.events[i].name;
+    return os;
+}
+
+/**
+ * What is sampled and how often: every `period` occurrences of the sampled
+ * event or, when it is 0, `frequency` times per second, the kernel adjusting
+ * the period as it goes. Tracepoints are sampled with a period, every single
+ * one of them unless there is one.
+ */
+struct sampling_spec
+{
+    event_list events;
+    std::uint64_t frequency = default_sampling_frequency;
+    std::uint64_t period = 0;
+
+    std::uint64_t effective_period() const
+    {
+        if (period == 0 && events.sampled().tracepoint())
+            return 1;
+        return period;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const sampling_spec& spec)
+{
+    os << spec.events.sampled().name;
+    if (const auto period = spec.effective_period())
+        return os << " every " << period << " events";
+    return os << " at " << spec.frequency << "Hz";
+}
+
+} // namespace
@@ -16,7 +16,7 @@ struct fifo
         // do not care about errors here
         ::unlink(path);
 
-        int ret = ::mkfifo(_path, 0x666);
+        int ret = ::mkfifo(_path, 0666);
         if (ret != 0)
             throw std::runtime_error{"could not create control fifo"};
 
@@ -0,0 +1,191 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perf.hpp"
+#include "reader.hpp"
+#include "cpu_list.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Fixed number of the most recent samples, the oldest one is overwritten
+ * when a new one does not fit.
+ */
+struct sample_history
+{
+    explicit sample_history(std::size_t capacity) : _samples(std::max<std::size_t>(capacity, 1))
+    {
+    }
+
+    void push(const sample_t& sample)
+    {
+        _samples[_next] = sample;
+        _next = _next + 1 == _samples.size() ? 0 : _next + 1;
+        _size = std::min(_size + 1, _samples.size());
+    }
+
+    /**
+     * Moves samples not older than `since` to the back of `out`, oldest
+     * first, and forgets all of them.
+     */
+    void take_since(std::uint64_t since, std::deque<profile_sample>& out)
+    {
+        auto first = _next + _samples.size() - _size;
+        for (std::size_t i = 0; i < _size; i++)
+        {
+            const auto& sample = _samples[(first + i) % _samples.size()];
+            if (sample.time >= since)
+                out.push_back(profile_sample{sample, {}});
+        }
+        _size = 0;
+    }
+
+    auto size() const
+    {
+        return _size;
+    }
+
+    auto capacity() const
+    {
+        return _samples.size();
+    }
+
+private:
+    std::vector<sample_t> _samples;
+    std::size_t _next = 0;
+    std::size_t _size = 0;
+};
+
+/**
+ * Always-on sampling at a low frequency which remembers only the last few
+ * seconds, so a profile taken on a trigger can show what led to it.
+ *
+ * The rings are drained rarely, the kernel wakes us up only when they are
+ * a quarter full, and every cpu has its own history so a busy cpu cannot
+ * push out samples of the others.
+ */
+struct flight_recorder
+{
+    /**
+     * Samples the event of `sampling` at `frequency`, whatever period the
+     * profiles use, so the histories cover the window. Tracepoints are not
+     * sampled by frequency, cpu-clock is instead. The other events are not
+     * counted.
+     */
+    flight_recorder(const cpu_list& cpus, std::chrono::seconds window, const sampling_spec& sampling,
+        std::uint64_t frequency, std::size_t data_pages)
+        : _window(window)
+    {
+        const auto& sampled = sampling.events.sampled();
+
+        sampling_spec spec;
+        spec.events.events = {sampled.tracepoint() ? cpu_clock_event() : sampled};
+        spec.frequency = frequency;
+        _event = spec.events.sampled().name;
+
+        auto attr = sampling_attr(spec);
+        attr.watermark = 1;
+        attr.wakeup_watermark = sysconf(_SC_PAGESIZE) * data_pages / 4;
+
+        // a quarter more than the window needs, the frequency is not exact
+        const std::size_t capacity = window.count() * frequency * 5 / 4;
+
+        for (auto cpu : cpus)
+        {
+            _sessions.push_back(std::make_unique<perf_session>(attr, cpu, data_pages));
+            _histories.emplace_back(capacity);
+        }
+    }
+
+    std::vector<int> fds() const
+    {
+        std::vector<int> ret;
+        for (const auto& session : _sessions)
+            ret.push_back(session->fd());
+        return ret;
+    }
+
+    /**
+     * Moves whatever the kernel has written so far into the histories.
+     */
+    void read()
+    {
+        _last_read = perf_clock_now();
+
+        for (std::size_t i = 0; i < _sessions.size(); i++)
+        {
+            auto& history = _histories[i];
+            _sessions[i]->read_some([&](const auto& sample) { history.push(sample); });
+        }
+    }
+
+    /**
+     * Passes samples from the window before the last `read` to `f` ordered by
+     * time and forgets them.
+     */
+    template<class F>
+    void dump(F&& f)
+    {
+        sample_merger merger{_histories.size()};
+        for (std::size_t i = 0; i < _histories.size(); i++)
+            _histories[i].take_since(oldest_needed(_last_read), merger.queue(i));
+        merger.pop_all(std::forward<F>(f));
+    }
+
+    /**
+     * Start of the window which ends at `now`, nothing that happened before
+     * it is needed to symbolize the samples which are kept.
+     */
+    std::uint64_t oldest_needed(std::uint64_t now) const
+    {
+        const auto window = std::chrono::duration_cast<std::chrono::nanoseconds>(_window).count();
+        return now > std::uint64_t(window) ? now - window : 0;
+    }
+
+    auto window() const
+    {
+        return _window;
+    }
+
+    /**
+     * Name of the event the history is sampled on.
+     */
+    const std::string& event() const
+    {
+        return _event;
+    }
+
+    /**
+     * What was lost on all cpus since the last call.
+     */
+    ring_stats take_stats()
+    {
+        ring_stats ret;
+        for (auto& session : _sessions)
+            ret += session->take_stats();
+        return ret;
+    }
+
+private:
+    std::chrono::seconds _window;
+    std::string _event;
+    std::vector<std::unique_ptr<perf_session>> _sessions;
+    std::vector<sample_history> _histories;
+    std::uint64_t _last_read = 0;
+};
+
+} // namespace
@@ -0,0 +1,115 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <linux/perf_event.h>
+
+#include "proc.hpp"
+#include "reader.hpp"
+#include "output.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Appends a frame to the folded stack, unknown names are replaced by the
+ * place in the file they come from, so at least frames of different code
+ * are not folded together.
+ */
+inline void append_folded_frame(std::string& stack, const symbol_t& symbol)
+{
+    stack += ';';
+
+    if (symbol.name != "-")
+    {
+        stack += symbol.name;
+        return;
+    }
+
+    if (symbol.pathname != "-")
+    {
+        stack += symbol.pathname;
+        stack += '+';
+    }
+
+    char hex[16];
+    auto end = std::to_chars(std::begin(hex), std::end(hex), std::uint64_t(symbol.addr), 16).ptr;
+    stack += "0x";
+    stack.append(hex, end);
+}
+
+/**
+ * Call stacks counted in memory, written in the folded format of
+ * flamegraph.pl: "comm;root;...;leaf count" per line.
+ */
+struct folded_stacks
+{
+    /**
+     * Symbolizes the call chain of the sample, or just its ip when there is
+     * none, and counts it.
+     */
+    void add(const running_processes_snapshot& processes, const profile_sample& sample)
+    {
+        _key.clear();
+        _key += processes.find_symbol(sample.pid, sample.ip).comm;
+
+        if (sample.callchain.empty())
+            append_folded_frame(_key, processes.find_symbol(sample.pid, sample.ip));
+
+        // frames go from the leaf to the root, mixed with markers of the context
+        // they come from, like PERF_CONTEXT_KERNEL
+        for (auto it = sample.callchain.rbegin(); it != sample.callchain.rend(); ++it)
+        {
+            if (*it >= std::uint64_t(PERF_CONTEXT_MAX))
+                continue;
+            append_folded_frame(_key, processes.find_symbol(sample.pid, *it));
+        }
+
+        auto it = _counts.find(_key);
+        if (it == _counts.end())
+            _counts.emplace(_key, 1);
+        else
+            it->second++;
+    }
+
+    /**
+     * Writes the stacks from the most frequent one and forgets them.
+     */
+    void write(output_stream& output)
+    {
+        std::vector<std::pair<std::string_view, std::uint64_t>> sorted{_counts.begin(), _counts.end()};
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+        {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+        for (const auto& [stack, count] : sorted)
+            output.write(stack).write(' ').write_dec(count).write('\n');
+
+        _counts.clear();
+    }
+
+    auto size() const
+    {
+        return _counts.size();
+    }
+
+private:
+    std::string _key;
+    std::unordered_map<std::string, std::uint64_t> _counts;
+};
+
+} // namespace
@@ -9,6 +9,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <iostream>
+#include <list>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <cassert>
 #include <signal.h>
@@ -20,11 +25,26 @@
 #include "utils.hpp"
 #include "output.hpp"
 #include "options.hpp"
+#include "reader.hpp"
+#include "tracker.hpp"
+#include "flight_recorder.hpp"
+#include "folded.hpp"
+#include "aggregate.hpp"
+#include "binary.hpp"
+#include "samples.hpp"
+#include "sidecar.hpp"
+#include "storage.hpp"
+#include "capture.hpp"
+#include "watchdog.hpp"
+#include "pressure.hpp"
+#include "control.hpp"
+#include "adaptive.hpp"
 
 namespace poor_perf
 {
 
 const char* CONTROL_FIFO_PATH = "/run/poor-profiler";
+const char* CONTROL_SOCKET_PATH = "/run/poor-profiler.sock";
 
 volatile sig_atomic_t signal_status = 0;
 
@@ -33,31 +53,420 @@ void signal_handler(int signal)
     signal_status = signal;
 }
 
-void profile_for(output_stream& output, std::size_t cpu, const running_processes_snapshot& processes, std::chrono::seconds secs)
+/**
+ * How the profile is taken, common for all modes.
+ */
+struct profile_settings
 {
-    event_loop loop{signal_status};
+    cpu_list cpus;
+    std::chrono::seconds duration;
+    std::size_t buffer_pages;
+    sampling_spec sampling;
+    format_t format;
+
+    // frames of call chains, they are sampled only for the folded format
+    std::uint16_t max_stack;
+
+    // time buckets of the aggregate format
+    std::chrono::milliseconds bucket;
+
+    bool compress;
+
+    // when the profile ends on its own rather than after `duration`
+    bool adaptive;
+    adaptive_limits limits;
+
+    // what was done about hardware counters which are not there
+    std::vector<std::string> fallback;
+};
+
+profile_settings profile_settings_from(const boost::program_options::variables_map& options)
+{
+    profile_settings ret;
+    ret.cpus = options["cpu"].as<cpu_list>();
+    ret.duration = std::chrono::seconds{options["duration"].as<std::size_t>()};
+    ret.buffer_pages = options["buffer-pages"].as<std::size_t>();
+    ret.sampling.events = options["event"].as<event_list>();
+    ret.sampling.frequency = options["frequency"].as<std::uint64_t>();
+    ret.sampling.period = options["period"].as<std::uint64_t>();
+    ret.format = options["format"].as<format_t>();
+    ret.max_stack = ret.format == format_t::folded ? options["max-stack"].as<std::uint16_t>() : 0;
+    ret.bucket = std::chrono::milliseconds{options["bucket"].as<std::size_t>()};
+    ret.compress = options["compress"].as<bool>();
+    ret.adaptive = options["adaptive"].as<bool>();
+    ret.limits.min_duration = std::chrono::seconds{options["min-duration"].as<std::size_t>()};
+    ret.limits.max_duration = std::chrono::seconds{options["max-duration"].as<std::size_t>()};
+    ret.limits.grace = std::chrono::milliseconds{options["grace"].as<std::size_t>()};
+    ret.limits.ramp_down = std::chrono::seconds{options["ramp-down"].as<std::size_t>()};
+    return ret;
+}
+
+/**
+ * Replaces the hardware events which cannot be opened, for the modes which
+ * open the sampling events; replaying a capture does not.
+ */
+void probe_events(profile_settings& settings)
+{
+    settings.fallback = fall_back_to_software(settings.sampling, settings.cpus.cpus.front());
+}
+
+profile_storage profile_storage_from(const boost::program_options::variables_map& options)
+{
+    return profile_storage{options["output"].as<std::string>(), options["rotate"].as<std::size_t>(),
+        std::uint64_t(options["rotate-mb"].as<std::size_t>()) << 20, options["compress"].as<bool>()};
+}
 
-    output.message("profiling cpu: ", cpu);
-    output << "$ time;cpu;pid;comm;pathname;addr;name\n";
+/**
+ * Opens the file the profile is written to.
+ */
+std::unique_ptr<output_stream> open_output(const profile_target& target, const profile_settings& settings)
+{
+    auto ret = std::make_unique<output_stream>(target.path, settings.compress);
+    ret->preallocate(target.preallocate);
+    if (settings.format == format_t::binary)
+        ret->use_binary_format();
+    else
+        ret->expect_format(false);
+    return ret;
+}
 
-    perf_session session{cpu};
-    loop.add_fd(session.fd());
+/**
+ * Writes the samples of a profile in the format of the settings, the ones
+ * which are counted are written only when it is finished.
+ */
+struct profile_printer
+{
+    profile_printer(output_stream& output, const profile_settings& settings, running_processes_snapshot& processes,
+        process_tracker& tracker)
+        : _output(output), _format(settings.format), _event(settings.sampling.events.sampled().name),
+          _processes(processes), _tracker(tracker), _histogram{std::uint64_t(std::chrono::nanoseconds{settings.bucket}.count())}
+    {
+        switch (_format)
+        {
+            case format_t::samples:
+                output.write(samples_format_line);
+                break;
+            case format_t::folded:
+                output.message("folded call stacks of at most ", settings.max_stack, " frames");
+                break;
+            case format_t::aggregate:
+                if (settings.bucket.count())
+                    output.message("samples counted in buckets of ", settings.bucket.count(), "ms");
+                break;
+            case format_t::binary:
+                _binary.emplace(output, _event);
+                break;
+        }
+    }
 
-    loop.run_for(secs, [&](auto fd)
+    void operator()(const profile_sample& sample)
     {
-        session.read_some([&](const auto& sample)
+        _tracker.apply_until(sample.time, _processes);
+
+        if (_format == format_t::folded)
         {
-            auto s = processes.find_symbol(sample.pid, sample.ip);
+            _stacks.add(_processes, sample);
+            return;
+        }
 
-            output << std::dec << sample.time << ';' << sample.cpu << ';' << sample.pid << ';'
-                   << s.comm << ';'
-                   << s.pathname <<
-                   ";0x" << std::hex << s.addr << ';'
-                   << s.name << '\n';
-        });
+        if (_format == format_t::aggregate)
+        {
+            _histogram.add(_processes, sample);
+            return;
+        }
+
+        auto s = _processes.find_symbol(sample.pid, sample.ip);
+
+        if (_binary)
+        {
+            _binary->write(sample.time, sample.cpu, sample.pid, s);
+            return;
+        }
+
+        write_sample_line(_output, sample, s, _event);
+    }
+
+    /**
+     * Samples printed from now on were taken on `event`.
+     */
+    void set_event(const std::string& event)
+    {
+        _event = event;
+        if (_binary)
+            _binary->set_event(event);
+    }
+
+    void finish()
+    {
+        if (_format == format_t::folded)
+            _stacks.write(_output);
+        else if (_format == format_t::aggregate)
+            _histogram.write(_output);
+        _output.flush();
+    }
+
+private:
+    output_stream& _output;
+    format_t _format;
+    std::string _event;
+    running_processes_snapshot& _processes;
+    process_tracker& _tracker;
+
+    folded_stacks _stacks;
+    sample_histogram _histogram;
+    std::optional<binary_profile_writer> _binary;
+};
+
+/**
+ * Events and their counts like "cycles 1000, instructions 2000".
+ */
+std::string counts_text(const event_list& events, const std::vector<std::uint64_t>& counts)
+{
+    std::ostringstream ss;
+    for (std::size_t i = 0; i < events.size() && i < counts.size(); i++)
+        ss << (i ? ", " : "") << events.events[i].name << ' ' << counts[i];
+    return ss.str();
+}
+
+/**
+ * Samples the cpus for the duration of the profile, when there is a flight
+ * recorder, samples it remembers go first. The maps of the binaries hit are
+ * written to `sidecar` unless it is empty.
+ *
+ * With adaptive settings and `starved`, which tells whether the system is
+ * still starved, the profile lasts as long as the starvation does, within
+ * the bounds of the settings.
+ *
+ * Meanwhile the profiling thread calls `wait`, which returns false when the
+ * profile is to be stopped, or sleeps when there is none.
+ */
+void profile_for(output_stream& output, const profile_settings& settings, const std::string& sidecar,
+    running_processes_snapshot& processes, process_tracker& tracker, flight_recorder* history = nullptr,
+    const std::function<bool()>& starved = {}, const std::function<bool(std::chrono::milliseconds)>& wait = {})
+{
+    // how often samples read on all cpus are put together and written, it is
+    // also how often the profiling thread checks if the time is up
+    const std::chrono::milliseconds merge_interval{50};
+
+    output.message("profiling cpus: ", settings.cpus);
+    for (const auto& line : settings.fallback)
+        output.message(line);
+    output.message("sampling ", settings.sampling);
+    if (settings.sampling.events.size() > 1)
+        output.message("counting ", settings.sampling.events, " in a group");
+
+    const bool adaptive = settings.adaptive && starved;
+    const auto& limits = settings.limits;
+    if (adaptive)
+        output.message("profiling while the system is starved and ", limits.grace.count(), "ms longer, from ",
+            limits.min_duration.count(), "s to ", limits.max_duration.count(), "s");
+
+    profile_printer print{output, settings, processes, tracker};
+
+    std::vector<std::unique_ptr<cpu_reader>> readers;
+    for (auto cpu : settings.cpus)
+        readers.push_back(std::make_unique<cpu_reader>(cpu, settings.buffer_pages, settings.max_stack,
+            settings.sampling, signal_status));
+
+    // whatever tracking records were lost before this window do not matter now
+    tracker.take_stats();
+    processes.revalidate_symbols();
+    processes.take_hits();
+    const auto start_time = perf_clock_now();
+
+    // the realtime readers only fill their queues, everything else is done
+    // by the writer at normal priority, away from the profiled cpus if possible
+    std::atomic<bool> readers_stopped{false};
+    std::exception_ptr writer_error;
+
+    auto writer = [&]
+    {
+        set_this_thread_name("poor-writer");
+        set_this_thread_into_normal();
+
+        auto cpus = except(online_cpus(), settings.cpus);
+        set_this_thread_affinity(cpus.size() ? cpus : online_cpus());
+
+        if (history)
+        {
+            output.message("samples of ", history->event(), " from the last ", history->window().count(),
+                "s before the trigger");
+            print.set_event(history->event());
+            history->dump(print);
+            print.set_event(settings.sampling.events.sampled().name);
+            output.flush();
+
+            auto stats = history->take_stats();
+            if (stats.lost)
+                output.message("history lost ", stats.lost, " samples");
+        }
+
+        sample_merger merger{readers.size()};
+
+        auto collect = [&]
+        {
+            for (std::size_t i = 0; i < readers.size(); i++)
+                merger.set_watermark(i, readers[i]->collect(merger.queue(i)));
+            tracker.read();
+        };
+
+        while (!readers_stopped.load(std::memory_order_acquire))
+        {
+            std::this_thread::sleep_for(merge_interval);
+
+            collect();
+            merger.pop_ready(print);
+            output.flush();
+        }
+
+        collect();
+        merger.pop_all(print);
+        tracker.apply_all(processes);
+        print.finish();
+    };
+
+    std::thread writer_thread{[&]
+    {
+        try
+        {
+            writer();
+        }
+        catch (...)
+        {
+            writer_error = std::current_exception();
+        }
+    }};
+
+    // the writer is stopped however the profiling loop is left, a thread
+    // which is still joinable would terminate the profiler while unwinding
+    auto stop_writer = [&]
+    {
+        for (auto& reader : readers)
+            reader->stop();
+
+        readers_stopped.store(true, std::memory_order_release);
+        writer_thread.join();
+    };
+
+    const auto started = event_loop::clock::now();
+    const auto deadline = started + (adaptive ? settings.limits.max_duration : settings.duration);
+    auto last_starved = started;
+
+    // either the frequency or the period, whichever the event is sampled with
+    const auto period = settings.sampling.effective_period();
+    const auto initial_rate = period ? period : settings.sampling.frequency;
+    auto rate = initial_rate;
+
+    // the ramping stops when the kernel refuses a rate, it is written once the writer is done
+    bool ramping = adaptive && settings.limits.ramp_down.count();
+    std::string ramp_error;
+
+    try
+    {
+        while (!signal_status)
+        {
+            auto now = event_loop::clock::now();
+            if (now >= deadline)
+                break;
+
+            if (adaptive)
+            {
+                if (starved())
+                    last_starved = now;
+
+                const auto step = next_adaptive_step(settings.limits, initial_rate, period != 0, now - started,
+                    now - last_starved);
+                if (step.stop)
+                    break;
+
+                // long incidents are sampled less often so the profile does not grow without bounds
+                if (ramping && step.rate != rate)
+                {
+                    try
+                    {
+                        for (auto& reader : readers)
+                            reader->set_rate(step.rate);
+                        rate = step.rate;
+                    }
+                    catch (const std::exception& e)
+                    {
+                        ramp_error = e.what();
+                        ramping = false;
+                    }
+                }
+            }
+
+            const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::min<event_loop::clock::duration>(merge_interval, deadline - now));
+            if (!wait)
+                std::this_thread::sleep_for(timeout);
+            else if (!wait(std::max(timeout, std::chrono::milliseconds{1})))
+                break;
+        }
+    }
+    catch (...)
+    {
+        stop_writer();
+        throw;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(event_loop::clock::now() - started);
+    stop_writer();
+
+    if (writer_error)
+        std::rethrow_exception(writer_error);
+
+    if (!sidecar.empty())
+    {
+        auto hits = processes.take_hits();
+        write_sidecar(sidecar, start_time, hits, processes);
+        output.message("maps of ", hits.size(), " regions hit by the samples are in ", sidecar);
+    }
+
+    const auto& events = settings.sampling.events;
+    std::vector<std::uint64_t> counted(events.size());
+    for (auto& reader : readers)
+    {
+        auto counts = reader->counts();
+        if (events.size() > 1)
+            output.message("cpu ", reader->cpu(), ": ", counts_text(events, counts));
+        for (std::size_t i = 0; i < counted.size() && i < counts.size(); i++)
+            counted[i] += counts[i];
+    }
+    output.message("counted ", counts_text(events, counted));
 
-        output.stream().flush();
-    });
+    ring_stats total;
+    std::uint64_t dropped_batches = 0, dropped_samples = 0;
+    for (auto& reader : readers)
+    {
+        auto stats = reader->take_stats();
+        if (stats.ring.lost || stats.ring.throttled)
+            output.message("cpu ", reader->cpu(), ": lost ", stats.ring.lost, " samples, throttled ", stats.ring.throttled, " times");
+        total += stats.ring;
+        dropped_batches += stats.dropped_batches;
+        dropped_samples += stats.dropped_samples;
+    }
+
+    output.message("lost ", total.lost, " samples, throttled ", total.throttled, " times");
+
+    if (adaptive)
+    {
+        output.message("profiled for ", elapsed.count(), "ms, the system was starved until ",
+            std::chrono::duration_cast<std::chrono::milliseconds>(last_starved - started).count(), "ms");
+        if (rate != initial_rate && period)
+            output.message("sampling period was ramped up to ", rate, " events");
+        else if (rate != initial_rate)
+            output.message("sampling frequency was ramped down to ", rate, "Hz");
+        if (!ramp_error.empty())
+            output.message("stopped ramping: ", ramp_error);
+    }
+
+    if (dropped_batches)
+        output.message("dropped ", dropped_batches, " batches with ", dropped_samples, " samples, writer could not keep up");
+
+    auto tracking = tracker.take_stats();
+    if (tracking.lost)
+        output.message("lost ", tracking.lost, " process tracking records, some samples may be symbolized wrong");
 
     output.message("done");
 }
@@ -66,7 +475,9 @@ enum class trigger
 {
     none,
     control_fifo,
-    watchdog
+    watchdog,
+    pressure,
+    control_socket
 };
 
 std::ostream& operator<<(std::ostream& os, trigger trigger)
@@ -76,26 +487,186 @@ std::ostream& operator<<(std::ostream& os, trigger trigger)
         case trigger::none: return os << "none";
         case trigger::control_fifo: return os << "control fifo";
         case trigger::watchdog: return os << "watchdog";
+        case trigger::pressure: return os << "cpu pressure";
+        case trigger::control_socket: return os << "control socket";
         default: return os << "<unknown>";
     }
     return os;
 }
 
-auto wait_for_trigger(watchdog& wdg)
+/**
+ * Profile a client asked for over the control socket.
+ */
+struct profile_request
+{
+    profile_settings settings;
+
+    // the profile is streamed to it instead of being written to the output
+    std::shared_ptr<control_client> stream_to;
+};
+
+/**
+ * What the watchdog mode has been doing, for the requests of the clients.
+ */
+struct daemon_status
+{
+    event_loop::clock::time_point started = event_loop::clock::now();
+    std::uint64_t profiles = 0;
+    trigger last_trigger = trigger::none;
+
+    // of the profile which is being taken
+    bool profiling = false;
+    event_loop::clock::time_point profile_started;
+    std::shared_ptr<control_client> streaming;
+    bool stop_requested = false;
+    // counted before it, the writer thread updates the snapshot meanwhile
+    std::size_t processes = 0;
+
+    std::optional<profile_request> pending;
+};
+
+/**
+ * Handles a request of a client, returns true when it asked for a profile,
+ * which is then pending in the status.
+ */
+using control_handler = std::function<bool(const std::shared_ptr<control_client>&, const control_request&)>;
+
+/**
+ * Settings of a "start" request, what it does not have is taken from the
+ * options. Throws when an argument is not valid.
+ */
+profile_settings request_settings(const control_request& request, const boost::program_options::variables_map& options)
+{
+    auto ret = profile_settings_from(options);
+
+    for (const auto& [key, value] : request.args)
+    {
+        std::istringstream is{value};
+        bool valid = false;
+
+        if (key == "cpu")
+            valid = bool(is >> ret.cpus) && ret.cpus.size() && except(ret.cpus, online_cpus()).size() == 0;
+        else if (key == "event")
+            valid = bool(is >> ret.sampling.events);
+        else if (key == "frequency")
+            valid = (is >> ret.sampling.frequency) && ret.sampling.frequency;
+        else if (key == "period")
+            valid = bool(is >> ret.sampling.period);
+        else if (key == "duration")
+        {
+            std::size_t seconds;
+            valid = bool(is >> seconds);
+            ret.duration = std::chrono::seconds{seconds};
+            ret.adaptive = false;
+        }
+        else if (key == "format")
+            valid = bool(is >> ret.format);
+        else if (key == "output")
+            valid = value == "-";
+
+        if (!valid)
+            throw std::runtime_error{"invalid argument '" + key + "=" + value + "'"};
+    }
+
+    ret.max_stack = ret.format == format_t::folded ? options["max-stack"].as<std::uint16_t>() : 0;
+    probe_events(ret);
+    return ret;
+}
+
+/**
+ * Waits for the control fifo, for a request of a control client, for a
+ * watchdog which is late by at least `threshold` or for the PSI trigger when
+ * there is one. The watchdogs are checked every interval of theirs, the
+ * trigger is delivered by the kernel. A trigger whose cgroup was removed is
+ * dropped.
+ */
+auto wait_for_trigger(std::list<watchdog>& wdgs, std::chrono::milliseconds threshold,
+    std::unique_ptr<pressure_trigger>& pressure, control_server& control, const control_handler& on_request,
+    running_processes_snapshot& processes, process_tracker& tracker, flight_recorder* history)
 {
     event_loop loop{signal_status};
 
     fifo control_fifo{CONTROL_FIFO_PATH};
     loop.add_fd(control_fifo.fd());
+    control.add_to(loop);
+
+    if (pressure)
+        loop.add_fd(pressure->fd(), EPOLLPRI);
+
+    for (auto fd : tracker.fds())
+        loop.add_fd(fd);
+
+    if (history)
+        for (auto fd : history->fds())
+            loop.add_fd(fd);
+
+    // samples in the history are yet to be symbolized, what has happened
+    // since the oldest of them is kept for later
+    auto update_processes = [&]
+    {
+        tracker.read();
+        if (history)
+        {
+            history->read();
+            tracker.apply_all_until(history->oldest_needed(perf_clock_now()), processes);
+        }
+        else
+            tracker.apply_all(processes);
+    };
+
+    // stalls which were profiled already do not count again
+    for (auto& wdg : wdgs)
+        wdg.lateness();
 
     std::cerr << "control fifo created at " << CONTROL_FIFO_PATH << '\n';
+    std::cerr << "control socket listening at " << control.path() << '\n';
     std::cerr << "waiting for trigger\n";
 
     auto trigger = trigger::none;
     while (trigger == trigger::none && !signal_status)
     {
-        auto read_control_fifo = [&](int)
+        auto read_control_fifo = [&](int fd)
         {
+            auto handle_request = [&](const auto& client, const control_request& request)
+            {
+                if (on_request(client, request) && trigger == trigger::none)
+                {
+                    loop.stop();
+                    trigger = trigger::control_socket;
+                }
+            };
+
+            if (control.handle(loop, fd, handle_request))
+                return;
+
+            if (pressure && fd == pressure->fd())
+            {
+                const auto current = pressure->current();
+                if (current.empty())
+                {
+                    std::cerr << pressure->path() << " cannot be read anymore, cpu pressure is not watched\n";
+                    loop.remove_fd(fd);
+                    pressure.reset();
+                    return;
+                }
+
+                pressure->fired();
+                std::cerr << "cpu pressure: " << current << '\n';
+                update_processes();
+                loop.stop();
+                trigger = trigger::pressure;
+                return;
+            }
+
+            if (fd != control_fifo.fd())
+            {
+                update_processes();
+                return;
+            }
+
+            if (history)
+                history->read();
+
             std::cerr << "woke up by control fifo\n";
             std::cerr << control_fifo.read();
             loop.stop();
@@ -104,16 +675,22 @@ auto wait_for_trigger(watchdog& wdg)
 
         auto timeout = [&]
         {
-            std::cerr << "watchdog ping\n";
-            if (!wdg.ping())
+            update_processes();
+
+            for (auto& wdg : wdgs)
             {
-                std::cerr << "watchdog is starved\n";
-                loop.stop();
-                trigger = trigger::watchdog;
+                const auto late = std::chrono::duration_cast<std::chrono::milliseconds>(wdg.lateness());
+                if (late >= threshold)
+                {
+                    std::cerr << "watchdog on cpu " << wdg.cpu() << " is " << late.count() << "ms late\n";
+                    loop.stop();
+                    trigger = trigger::watchdog;
+                }
             }
         };
 
-        loop.run_for(wdg.interval() * 2, read_control_fifo, timeout);
+        const auto check_interval = std::chrono::duration_cast<std::chrono::milliseconds>(wdgs.front().interval());
+        loop.run_for(std::max(check_interval, std::chrono::milliseconds{1}), read_control_fifo, timeout);
     }
 
     return trigger;
@@ -121,47 +698,392 @@ auto wait_for_trigger(watchdog& wdg)
 
 void watchdog_mode(const boost::program_options::variables_map& options)
 {
-    const auto output = options["output"].as<std::string>();
-    const auto duration = options["duration"].as<std::size_t>();
-    const auto cpu = options["cpu"].as<std::size_t>();
+    auto settings = profile_settings_from(options);
+    probe_events(settings);
+    auto storage = profile_storage_from(options);
 
+    process_tracker tracker{settings.buffer_pages};
     running_processes_snapshot proc;
-    watchdog wdg{cpu};
 
+    std::unique_ptr<flight_recorder> history;
+    if (const auto window = options["history"].as<std::size_t>())
+        history = std::make_unique<flight_recorder>(settings.cpus, std::chrono::seconds{window}, settings.sampling,
+            options["history-frequency"].as<std::uint64_t>(), settings.buffer_pages);
+
+    const std::chrono::milliseconds interval{options["watchdog-interval"].as<std::size_t>()};
+    const std::chrono::milliseconds threshold{options["watchdog-threshold"].as<std::size_t>()};
+    const std::chrono::seconds report_interval{options["latency-report"].as<std::size_t>()};
+
+    std::unique_ptr<pressure_trigger> pressure;
+    if (const auto stall = options["psi-stall"].as<std::size_t>())
+        pressure = std::make_unique<pressure_trigger>(cpu_pressure_path(options["psi-cgroup"].as<std::string>()),
+            std::chrono::milliseconds{stall}, std::chrono::milliseconds{options["psi-window"].as<std::size_t>()});
+    if (pressure)
+        std::cerr << "cpu pressure trigger set on " << pressure->path() << '\n';
+
+    // watchdog is not movable, hence the list
+    std::list<watchdog> wdgs;
+    for (auto cpu : settings.cpus)
+        wdgs.emplace_back(cpu, interval, report_interval);
+
+    // all of the watchdogs are asked so none of them keeps a stale lateness
+    auto starved = [&]
     {
-        output_stream f{output};
-        f.message("watchdog mode started on cpu ", cpu);
-    }
+        bool ret = pressure && pressure->stalling();
+        for (auto& wdg : wdgs)
+            ret = wdg.lateness() >= threshold || ret;
+        return ret;
+    };
+
+    control_server control{CONTROL_SOCKET_PATH};
+    daemon_status status;
+
+    auto on_request = [&](const std::shared_ptr<control_client>& client, const control_request& request)
+    {
+        // what is streamed to a client must not be mixed with replies
+        if (client == status.streaming)
+        {
+            status.stop_requested = status.stop_requested || request.command == "stop";
+            return false;
+        }
+
+        if (request.command == "stats")
+        {
+            using std::chrono::duration_cast;
+            const auto now = event_loop::clock::now();
+
+            std::ostringstream ss;
+            ss << "uptime " << duration_cast<std::chrono::seconds>(now - status.started).count() << '\n'
+               << "profiles " << status.profiles << '\n'
+               << "last_trigger " << status.last_trigger << '\n'
+               << "profiling " << status.profiling << '\n';
+            if (status.profiling)
+                ss << "profile_elapsed_ms " << duration_cast<std::chrono::milliseconds>(now - status.profile_started).count() << '\n';
+            ss << "processes " << (status.profiling ? status.processes : proc.size()) << '\n'
+               << "clients " << control.clients() << '\n'
+               << "ok\n";
+            client->reply(ss.str());
+        }
+        else if (request.command == "stop")
+        {
+            status.stop_requested = status.profiling;
+            client->reply(status.profiling ? "ok\n" : "error not profiling\n");
+        }
+        else if (request.command == "start")
+        {
+            if (status.profiling || status.pending)
+            {
+                client->reply("error already profiling\n");
+                return false;
+            }
+
+            try
+            {
+                const bool stream = request.args.count("output");
+                status.pending = profile_request{request_settings(request, options), stream ? client : nullptr};
+            }
+            catch (const std::exception& e)
+            {
+                client->reply(std::string{"error "} + e.what() + '\n');
+                return false;
+            }
+
+            client->reply("ok\n");
+            return true;
+        }
+        else
+            client->reply("error unknown command '" + request.command + "', valid ones are: start, stop, stats\n");
+
+        return false;
+    };
+
+    // clients are served while the profile is taken as well
+    std::unique_ptr<event_loop> profile_loop;
+    auto wait = [&](std::chrono::milliseconds timeout)
+    {
+        profile_loop->run_once([&](int fd) { control.handle(*profile_loop, fd, on_request); }, timeout);
+        if (status.streaming && status.streaming->failed())
+            std::cerr << "control client does not keep up with the streamed profile, it is disconnected\n";
+        if (status.streaming && (!control.connected(status.streaming) || status.streaming->failed()))
+            return false;
+        return !status.stop_requested;
+    };
+
+    if (storage.rotating())
+        std::cout << "watchdog mode started on cpus " << settings.cpus << ", every profile goes to a file of its own\n";
+    else
+        open_output(storage.next(), settings)->message("watchdog mode started on cpus ", settings.cpus,
+            ", triggered by wakeups ", threshold.count(), "ms late");
 
     // childs inherit sched so set it after watchdog is started
     set_this_thread_into_realtime();
 
     while (!signal_status)
     {
-        auto t = wait_for_trigger(wdg);
+        auto t = wait_for_trigger(wdgs, threshold, pressure, control, on_request, proc, tracker, history.get());
+        if (t == trigger::none)
+            continue;
+
+        status.profiles++;
+        status.last_trigger = t;
+        status.processes = proc.size();
+        status.profiling = true;
+        status.profile_started = event_loop::clock::now();
+        status.stop_requested = false;
 
-        if (t != trigger::none)
+        profile_loop = std::make_unique<event_loop>(signal_status);
+        control.add_to(*profile_loop);
+
+        if (t == trigger::control_socket)
+        {
+            auto request = std::move(*status.pending);
+            status.pending.reset();
+
+            // what the client asked for may not be possible, that does not stop the watchdog
+            try
+            {
+                if (request.stream_to)
+                {
+                    status.streaming = request.stream_to;
+                    {
+                        // the writer never waits for the client, one which falls behind fails
+                        auto client = request.stream_to;
+                        output_stream stream{[client](std::string_view data) { client->reply(data); }};
+                        if (request.settings.format == format_t::binary)
+                            stream.use_binary_format();
+                        stream.message("woke up by ", t);
+                        profile_for(stream, request.settings, {}, proc, tracker, nullptr, {}, wait);
+                    }
+                    control.disconnect(request.stream_to);
+                    status.streaming.reset();
+                }
+                else
+                {
+                    const auto target = storage.next();
+                    {
+                        auto f = open_output(target, request.settings);
+                        f->message("woke up by ", t);
+                        profile_for(*f, request.settings, target.sidecar, proc, tracker, nullptr, {}, wait);
+                    }
+                    storage.prune();
+                }
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "requested profile failed: " << e.what() << '\n';
+                if (status.streaming)
+                {
+                    status.streaming->reply(std::string{"error "} + e.what() + '\n');
+                    control.disconnect(status.streaming);
+                    status.streaming.reset();
+                }
+            }
+        }
+        else
         {
-            // I want to make sure that after profiling is done, the
-            // file is flushed and closed
-            output_stream f{output};
-            f.message("woke up by ", t);
-            profile_for(f, cpu, proc, std::chrono::seconds{duration});
+            const auto target = storage.next();
+            {
+                // I want to make sure that after profiling is done, the
+                // file is flushed and closed
+                auto f = open_output(target, settings);
+                f->message("woke up by ", t);
+                profile_for(*f, settings, target.sidecar, proc, tracker, history.get(), starved, wait);
+            }
+
+            if (auto removed = storage.prune())
+                std::cout << "removed " << removed << " oldest profiles\n";
         }
+
+        status.profiling = false;
+        profile_loop.reset();
     }
 }
 
 void oneshot_mode(const boost::program_options::variables_map& options)
 {
-    const auto output = options["output"].as<std::string>();
-    const auto duration = options["duration"].as<std::size_t>();
-    const auto cpu = options["cpu"].as<std::size_t>();
+    auto settings = profile_settings_from(options);
+    probe_events(settings);
+    auto storage = profile_storage_from(options);
+    const auto target = storage.next();
 
     set_this_thread_into_realtime();
+    process_tracker tracker{settings.buffer_pages};
     running_processes_snapshot proc;
-    output_stream f{output};
-    f.message("oneshot profiling");
-    profile_for(f, cpu, proc, std::chrono::seconds{duration});
+    {
+        auto f = open_output(target, settings);
+        f->message("oneshot profiling");
+        profile_for(*f, settings, target.sidecar, proc, tracker);
+    }
+    storage.prune();
+}
+
+/**
+ * Writes raw records of the sampled cpus and of the processes for the
+ * duration of the profile, along with the kernel symbols and the processes
+ * which were running before, so it can be replayed offline.
+ */
+void capture_mode(const boost::program_options::variables_map& options)
+{
+    const auto output = options["output"].as<std::string>();
+    auto settings = profile_settings_from(options);
+    probe_events(settings);
+    const auto sample_type = settings.max_stack ? callchain_sample_t::type : sample_t::type;
+
+    // records are captured before the snapshot is taken so nothing falls between the two
+    capture_writer capture{output};
+    process_tracker tracker{settings.buffer_pages};
+    tracker.capture_to([&capture](std::uint32_t cpu, std::string_view records) { capture.tracking(cpu, records); });
+    capture.snapshot();
+    capture.event(settings.sampling.events.sampled().name);
+
+    // the realtime readers only fill their queues, the records are written
+    // by the writer at normal priority, away from the profiled cpus if possible
+    set_this_thread_into_realtime();
+
+    std::vector<std::unique_ptr<cpu_reader>> readers;
+    for (auto cpu : settings.cpus)
+    {
+        readers.push_back(std::make_unique<cpu_reader>(cpu, settings.buffer_pages, settings.max_stack,
+            settings.sampling, signal_status, [&capture, cpu, sample_type](std::string_view records) { capture.samples(cpu, sample_type, records); }));
+    }
+
+    for (const auto& line : settings.fallback)
+        std::cout << line << '\n';
+    std::cout << "capturing cpus " << settings.cpus << ", sampling " << settings.sampling << ", to " << output << '\n';
+
+    std::atomic<bool> readers_stopped{false};
+    std::exception_ptr writer_error;
+    std::uint64_t samples = 0;
+
+    std::thread writer_thread{[&]
+    {
+        try
+        {
+            set_this_thread_name("poor-writer");
+            set_this_thread_into_normal();
+
+            auto cpus = except(online_cpus(), settings.cpus);
+            set_this_thread_affinity(cpus.size() ? cpus : online_cpus());
+
+            std::deque<profile_sample> ignored;
+            auto collect = [&]
+            {
+                for (auto& reader : readers)
+                    reader->collect(ignored);
+                samples += ignored.size();
+                ignored.clear();
+                tracker.read();
+            };
+
+            while (!readers_stopped.load(std::memory_order_acquire))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds{50});
+                collect();
+            }
+
+            collect();
+            capture.flush();
+        }
+        catch (...)
+        {
+            writer_error = std::current_exception();
+        }
+    }};
+
+    const auto deadline = event_loop::clock::now() + settings.duration;
+    while (!signal_status && event_loop::clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+
+    for (auto& reader : readers)
+        reader->stop();
+
+    readers_stopped.store(true, std::memory_order_release);
+    writer_thread.join();
+
+    if (writer_error)
+        std::rethrow_exception(writer_error);
+
+    std::cout << "captured " << samples << " samples\n";
+}
+
+/**
+ * Feeds the records of a capture through the same decoding, symbolization
+ * and output as a live profile, as fast as it goes.
+ */
+void replay_mode(const boost::program_options::variables_map& options)
+{
+    const auto input = options["input"].as<std::string>();
+    auto settings = profile_settings_from(options);
+    auto storage = profile_storage_from(options);
+    const auto target = storage.next();
+
+    auto capture = read_capture(input);
+
+    // the samples were taken on the event of the capture, whatever the options say
+    settings.sampling.events.events = {perf_event_spec{capture.event}};
+    running_processes_snapshot processes{kernel_symbols::from_text(capture.kallsyms), std::move(capture.processes)};
+
+    process_tracker tracker;
+    for (const auto& [cpu, records] : capture.tracking)
+    {
+        replayed_ring ring{records};
+        tracker.read(ring.reader());
+    }
+
+    {
+        auto f = open_output(target, settings);
+        auto& output = *f;
+        output.message("replaying ", input);
+
+        const auto started = std::chrono::steady_clock::now();
+        profile_printer print{output, settings, processes, tracker};
+        sample_merger merger{capture.samples.size()};
+        ring_stats total;
+
+        std::size_t source = 0;
+        for (const auto& [cpu, ring] : capture.samples)
+        {
+            replayed_ring replayed{ring.records};
+            auto& queue = merger.queue(source++);
+            auto ignore = [](const perf_event_header&, const char*) {};
+
+            if (ring.sample_type == callchain_sample_t::type)
+            {
+                read_records<callchain_sample_t::type>(replayed.reader(), total, [&](const callchain_sample_t& sample)
+                {
+                    queue.push_back(profile_sample{leaf_of(sample), {sample.ips, sample.ips + sample.nr}});
+                }, ignore);
+            }
+            else if (ring.sample_type == sample_t::type)
+                read_records(replayed.reader(), total, [&](const sample_t& sample) { queue.push_back({sample, {}}); }, ignore);
+            else
+                throw std::runtime_error{"samples of cpu " + std::to_string(cpu) + " have an unknown sample type"};
+        }
+
+        std::uint64_t samples = 0;
+        merger.pop_all([&](const profile_sample& sample)
+        {
+            samples++;
+            print(sample);
+        });
+        tracker.apply_all(processes);
+        print.finish();
+
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        if (!target.sidecar.empty())
+        {
+            auto hits = processes.take_hits();
+            write_sidecar(target.sidecar, 0, hits, processes);
+            output.message("maps of ", hits.size(), " regions hit by the samples are in ", target.sidecar);
+        }
+
+        output.message("lost ", total.lost, " samples, throttled ", total.throttled, " times");
+        output.message("replayed ", samples, " samples in ", elapsed, "s, ", std::uint64_t(samples / std::max(elapsed, 1e-9)),
+            " samples per second");
+        output.message("done");
+    }
+    storage.prune();
 }
 
 } // namespace
@@ -175,6 +1097,9 @@ int main(int argc, char **argv)
     ::signal(SIGINT, poor_perf::signal_handler);
     ::signal(SIGTERM, poor_perf::signal_handler);
 
+    // a control client may hang up while a profile is streamed to it
+    ::signal(SIGPIPE, SIG_IGN);
+
     switch (options["mode"].as<poor_perf::mode_t>())
     {
     case poor_perf::mode_t::watchdog:
@@ -183,6 +1108,12 @@ int main(int argc, char **argv)
     case poor_perf::mode_t::oneshot:
         poor_perf::oneshot_mode(options);
         break;
+    case poor_perf::mode_t::capture:
+        poor_perf::capture_mode(options);
+        break;
+    case poor_perf::mode_t::replay:
+        poor_perf::replay_mode(options);
+        break;
     }
 }
 
@@ -9,13 +9,20 @@
 #include <iostream>
 #include <boost/program_options.hpp>
 
+#include "cpu_list.hpp"
+#include "events.hpp"
+
 namespace poor_perf
 {
 
 enum class mode_t
 {
     watchdog,
-    oneshot
+    oneshot,
+
+    // raw records to be replayed later
+    capture,
+    replay
 };
 
 std::istream& operator>>(std::istream& is, mode_t& mode)
@@ -27,6 +34,10 @@ std::istream& operator>>(std::istream& is, mode_t& mode)
         mode = mode_t::watchdog;
     else if (s == "oneshot")
         mode = mode_t::oneshot;
+    else if (s == "capture")
+        mode = mode_t::capture;
+    else if (s == "replay")
+        mode = mode_t::replay;
     else
         is.setstate(std::ios_base::failbit);
 
@@ -38,6 +49,55 @@ std::ostream& operator<<(std::ostream& os, const mode_t&)
     return os << "mode";
 }
 
+/**
+ * What is written for the samples.
+ */
+enum class format_t
+{
+    // one line per sample
+    samples,
+
+    // call stacks counted over the whole profile
+    folded,
+
+    // samples counted per pid and address
+    aggregate,
+
+    // one fixed size record per sample with strings written once
+    binary
+};
+
+std::istream& operator>>(std::istream& is, format_t& format)
+{
+    std::string s;
+    is >> s;
+
+    if (s == "samples")
+        format = format_t::samples;
+    else if (s == "folded")
+        format = format_t::folded;
+    else if (s == "aggregate")
+        format = format_t::aggregate;
+    else if (s == "binary")
+        format = format_t::binary;
+    else
+        is.setstate(std::ios_base::failbit);
+
+    return is;
+}
+
+std::ostream& operator<<(std::ostream& os, format_t format)
+{
+    switch (format)
+    {
+        case format_t::samples: return os << "samples";
+        case format_t::folded: return os << "folded";
+        case format_t::aggregate: return os << "aggregate";
+        case format_t::binary: return os << "binary";
+    }
+    return os;
+}
+
 auto parse_options(int argc, char **argv)
 {
     namespace po = boost::program_options;
@@ -45,14 +105,79 @@ auto parse_options(int argc, char **argv)
     po::options_description desc;
     desc.add_options()
         ("output", po::value<std::string>()->default_value("/rom/profile.txt"))
-        ("cpu", po::value<std::size_t>()->default_value(0u))
+        ("input", po::value<std::string>()->default_value(""))
+        ("cpu", po::value<cpu_list>()->default_value(cpu_list{{0u}}, "0"))
         ("duration", po::value<std::size_t>()->default_value(5u))
-        ("mode", po::value<mode_t>()->default_value(mode_t::watchdog));
+        ("mode", po::value<mode_t>()->default_value(mode_t::watchdog))
+        ("buffer-pages", po::value<std::size_t>()->default_value(64u))
+        ("event", po::value<event_list>()->default_value(event_list{}, "cycles"))
+        ("frequency", po::value<std::uint64_t>()->default_value(default_sampling_frequency))
+        ("period", po::value<std::uint64_t>()->default_value(0u))
+        ("history", po::value<std::size_t>()->default_value(3u))
+        ("history-frequency", po::value<std::uint64_t>()->default_value(100u))
+        ("format", po::value<format_t>()->default_value(format_t::samples))
+        ("max-stack", po::value<std::uint16_t>()->default_value(32u))
+        ("bucket", po::value<std::size_t>()->default_value(0u))
+        ("rotate", po::value<std::size_t>()->default_value(0u))
+        ("rotate-mb", po::value<std::size_t>()->default_value(0u))
+        ("compress", po::bool_switch())
+        ("watchdog-interval", po::value<std::size_t>()->default_value(100u))
+        ("watchdog-threshold", po::value<std::size_t>()->default_value(200u))
+        ("latency-report", po::value<std::size_t>()->default_value(60u))
+        ("psi-stall", po::value<std::size_t>()->default_value(0u))
+        ("psi-window", po::value<std::size_t>()->default_value(1000u))
+        ("psi-cgroup", po::value<std::string>()->default_value(""))
+        ("adaptive", po::bool_switch())
+        ("min-duration", po::value<std::size_t>()->default_value(1u))
+        ("max-duration", po::value<std::size_t>()->default_value(60u))
+        ("grace", po::value<std::size_t>()->default_value(1000u))
+        ("ramp-down", po::value<std::size_t>()->default_value(0u));
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
 
+    const auto pages = vm["buffer-pages"].as<std::size_t>();
+    if (pages == 0 || (pages & (pages - 1)))
+        throw po::validation_error{po::validation_error::invalid_option_value, "buffer-pages"};
+
+    if (vm["max-stack"].as<std::uint16_t>() == 0)
+        throw po::validation_error{po::validation_error::invalid_option_value, "max-stack"};
+
+    if (vm["frequency"].as<std::uint64_t>() == 0)
+        throw po::validation_error{po::validation_error::invalid_option_value, "frequency"};
+
+    if (vm["history-frequency"].as<std::uint64_t>() == 0)
+        throw po::validation_error{po::validation_error::invalid_option_value, "history-frequency"};
+
+    if (vm["watchdog-interval"].as<std::size_t>() == 0)
+        throw po::validation_error{po::validation_error::invalid_option_value, "watchdog-interval"};
+
+    if (vm["watchdog-threshold"].as<std::size_t>() == 0)
+        throw po::validation_error{po::validation_error::invalid_option_value, "watchdog-threshold"};
+
+    if (vm["min-duration"].as<std::size_t>() > vm["max-duration"].as<std::size_t>())
+        throw po::validation_error{po::validation_error::invalid_option_value, "min-duration"};
+
+    // what the kernel accepts for PSI triggers
+    const auto psi_window = vm["psi-window"].as<std::size_t>();
+    if (psi_window < 500 || psi_window > 10000)
+        throw po::validation_error{po::validation_error::invalid_option_value, "psi-window"};
+
+    if (vm["psi-stall"].as<std::size_t>() > psi_window)
+        throw po::validation_error{po::validation_error::invalid_option_value, "psi-stall"};
+
+    const auto mode = vm["mode"].as<mode_t>();
+    if (mode == mode_t::replay && vm["input"].as<std::string>().empty())
+        throw po::validation_error{po::validation_error::invalid_option_value, "input"};
+
+    if (mode == mode_t::capture && vm["output"].as<std::string>() == "-")
+        throw po::validation_error{po::validation_error::invalid_option_value, "output"};
+
+    const bool rotating = vm["rotate"].as<std::size_t>() || vm["rotate-mb"].as<std::size_t>();
+    if (rotating && vm["output"].as<std::string>() == "-")
+        throw po::validation_error{po::validation_error::invalid_option_value, "rotate"};
+
     return vm;
 }
 
@@ -6,10 +6,28 @@
  */
 #pragma once
 
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+#include "binary_format.hpp"
+#include "compress.hpp"
+
 namespace poor_perf
 {
 
-void stream_to(std::ostream&)
+inline void stream_to(std::ostream&)
 {
 }
 
@@ -21,21 +39,78 @@ void stream_to(std::ostream& os, Arg&& arg, Args&&... args)
 }
 
 /**
- * Wrapper over fstream that can optionaly hold a reference to cout so you can pass "-" as a filename.
+ * Buffered writer over a file descriptor, "-" as a filename means standard output.
+ *
+ * Text is formatted straight into a preallocated buffer which is written
+ * with a single write(2) when it is flushed or grows over the threshold, so
+ * writing a sample neither allocates nor goes through iostreams.
+ *
+ * When it is compressed, flushed buffers are handed over to a gzip stream
+ * compressed in the background.
  */
 struct output_stream
 {
-    output_stream(const std::string& path)
+    constexpr static std::size_t flush_threshold = 1 << 16;
+
+    output_stream(const std::string& path, bool compress = false)
     {
         if (path == "-")
-            _output = &std::cout;
+            _fd = STDOUT_FILENO;
         else
         {
-            _fstream.open(path, std::fstream::out | std::fstream:: app | std::fstream::ate);
-            if (!_fstream)
+            _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (_fd == -1)
                 throw std::runtime_error{"could not open '" + path + "' for writing"};
-            _output = &_fstream;
+
+            _path = path;
+            _appended_to = head_of(path);
         }
+
+        _buffer.resize(flush_threshold * 2);
+
+        if (compress)
+            _compressor = std::make_unique<gzip_compressor>(_fd);
+    }
+
+    /**
+     * Hands whatever is flushed over to `sink` instead of writing it, like
+     * to a client which is never waited for.
+     */
+    explicit output_stream(std::function<void(std::string_view)> sink) : _fd(-1), _sink(std::move(sink))
+    {
+        _buffer.resize(flush_threshold * 2);
+    }
+
+    output_stream(const output_stream&) = delete;
+    output_stream& operator=(const output_stream&) = delete;
+
+    ~output_stream()
+    {
+        flush();
+        _compressor.reset();
+
+        if (_preallocated)
+        {
+            // blocks allocated past the end are given back
+            struct stat st;
+            if (::fstat(_fd, &st) == 0)
+                while (::ftruncate(_fd, st.st_size) == -1 && errno == EINTR)
+                    ;
+        }
+
+        if (_fd != -1 && !streaming_to_stdout())
+            ::close(_fd);
+    }
+
+    /**
+     * Allocates `size` bytes on the disk past the end of the file without
+     * changing its size, so what is written later goes to blocks which
+     * were reserved at once. Unused ones are released when it is closed.
+     */
+    void preallocate(std::size_t size)
+    {
+        if (size && !streaming_to_stdout() && ::fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+            _preallocated = true;
     }
 
     /**
@@ -44,39 +119,181 @@ struct output_stream
     template<class... Args>
     void message(Args&&... args)
     {
-        message_impl("# ", current_time{}, ": ", std::forward<Args>(args)..., '\n');
+        std::ostringstream ss;
+        stream_to(ss, "# ", current_time{}, ": ", std::forward<Args>(args)..., '\n');
+        const auto text = ss.str();
+
+        if (_binary)
+        {
+            // without the "# " and the new line
+            auto line = std::string_view{text}.substr(2, text.size() - 3);
+            write(char(binary_record::message)).write_le(std::uint16_t(line.size())).write(line);
+        }
+        else
+            write(text);
+
+        if (!streaming_to_stdout())
+            std::cout << text;
     }
 
-    std::ostream& stream()
+    /**
+     * From now on, messages are written as records of the binary format,
+     * which starts with its magic when the file is empty.
+     */
+    void use_binary_format()
     {
-        return *_output;
+        if (_binary)
+            return;
+
+        expect_format(true);
+        _binary = true;
+        if (::lseek(_fd, 0, SEEK_END) <= 0 && _size == 0)
+            write(binary_magic);
+    }
+
+    /**
+     * Throws when the profiles the file has already are in the other format,
+     * a profile appended to them could not be read back.
+     */
+    void expect_format(bool binary) const
+    {
+        if (_appended_to.empty() || is_binary_profile(_appended_to) == binary)
+            return;
+
+        throw std::runtime_error{"'" + _path + "' has " + (binary ? "text" : "binary") + " profiles, " +
+            (binary ? "binary" : "text") + " ones are not appended to it"};
+    }
+
+    /**
+     * Bytes of the number as they are in memory, little endian on every
+     * platform we run on.
+     */
+    template<class T>
+    output_stream& write_le(T value)
+    {
+        return write(std::string_view(reinterpret_cast<const char*>(&value), sizeof(value)));
+    }
+
+    output_stream& write(std::string_view s)
+    {
+        reserve(s.size());
+        s.copy(&_buffer[_size], s.size());
+        _size += s.size();
+        return *this;
+    }
+
+    output_stream& write(char c)
+    {
+        reserve(1);
+        _buffer[_size++] = c;
+
+        if (c == '\n' && _size >= flush_threshold)
+            flush();
+        return *this;
+    }
+
+    output_stream& write_dec(std::uint64_t value)
+    {
+        char tmp[20];
+        auto p = std::end(tmp);
+        do
+        {
+            *--p = '0' + value % 10;
+            value /= 10;
+        }
+        while (value);
+        return write(std::string_view(p, std::end(tmp) - p));
+    }
+
+    /**
+     * Lowercase digits without the 0x prefix, like std::hex does it.
+     */
+    output_stream& write_hex(std::uint64_t value)
+    {
+        char tmp[16];
+        auto p = std::end(tmp);
+        do
+        {
+            *--p = "0123456789abcdef"[value & 0xf];
+            value >>= 4;
+        }
+        while (value);
+        return write(std::string_view(p, std::end(tmp) - p));
+    }
+
+    /**
+     * Writes out whatever is buffered.
+     */
+    void flush()
+    {
+        if (_size == 0)
+            return;
+
+        // there is nobody to complain to, just like with the fstream before
+        if (_sink)
+            _sink(std::string_view{_buffer.data(), _size});
+        else if (_compressor)
+            _compressor->write(_buffer.data(), _size);
+        else
+            write_all(_fd, _buffer.data(), _size);
+        _size = 0;
     }
 
 private:
-    template<class... Args>
-    void message_impl(Args&&... args)
+    void reserve(std::size_t size)
     {
-        stream_to(stream(), std::forward<Args>(args)...);
+        if (_size + size <= _buffer.size())
+            return;
 
-        if (!streaming_to_stdout())
-            stream_to(std::cout, std::forward<Args>(args)...);
+        flush();
+        if (size > _buffer.size())
+            _buffer.resize(size);
     }
 
     bool streaming_to_stdout() const
     {
-        return _output == &std::cout;
+        return _fd == STDOUT_FILENO;
     }
 
-    std::ostream* _output;
-    std::fstream _fstream;
-};
+    /**
+     * The first bytes of what the file has, decompressed when it is.
+     */
+    static std::string head_of(const std::string& path)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return {};
 
-template<class T>
-output_stream& operator<<(output_stream& os, T&& t)
-{
-    os.stream() << t;
-    return os;
-}
+        std::string ret(1 << 12, '\0');
+        auto n = ::read(fd, &ret[0], ret.size());
+        ::close(fd);
+        ret.resize(n > 0 ? n : 0);
+
+        if (!is_gzip(ret))
+            return ret;
 
+        try
+        {
+            return gunzip(ret, binary_magic.size());
+        }
+        catch (const std::exception&)
+        {
+            return ret;
+        }
+    }
+
+    int _fd;
+    std::string _path;
+
+    // start of the profiles which were in the file already
+    std::string _appended_to;
+
+    std::function<void(std::string_view)> _sink;
+    std::vector<char> _buffer;
+    std::size_t _size = 0;
+    bool _binary = false;
+    bool _preallocated = false;
+    std::unique_ptr<gzip_compressor> _compressor;
+};
 
 } // namespace
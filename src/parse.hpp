@@ -0,0 +1,127 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace poor_perf
+{
+
+/**
+ * Reads the whole file with plain read(2) calls, files in /proc report their
+ * size as 0 so it is read until EOF. Returns an empty string on error.
+ */
+inline std::string read_file(const std::string& path, std::size_t chunk = 1 << 16)
+{
+    std::string ret;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return ret;
+
+    std::size_t size = 0;
+    while (true)
+    {
+        ret.resize(size + chunk);
+        auto n = ::read(fd, &ret[size], chunk);
+        if (n <= 0)
+            break;
+        size += n;
+    }
+
+    ::close(fd);
+    ret.resize(size);
+    return ret;
+}
+
+/**
+ * Splits the text into lines without copying them.
+ */
+inline bool next_line(std::string_view& text, std::string_view& line)
+{
+    if (text.empty())
+        return false;
+
+    auto eol = text.find('\n');
+    if (eol == std::string_view::npos)
+    {
+        line = text;
+        text = {};
+    }
+    else
+    {
+        line = text.substr(0, eol);
+        text.remove_prefix(eol + 1);
+    }
+    return true;
+}
+
+inline void skip_spaces(std::string_view& s)
+{
+    std::size_t i = 0;
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t'))
+        i++;
+    s.remove_prefix(i);
+}
+
+/**
+ * Skips leading blanks and takes everything up to the next one.
+ */
+inline std::string_view next_field(std::string_view& s)
+{
+    skip_spaces(s);
+
+    std::size_t i = 0;
+    while (i < s.size() && s[i] != ' ' && s[i] != '\t')
+        i++;
+
+    auto ret = s.substr(0, i);
+    s.remove_prefix(i);
+    return ret;
+}
+
+/**
+ * Consumes hex digits, stops at the first character which is not one.
+ */
+inline std::uint64_t parse_hex(std::string_view& s)
+{
+    std::uint64_t ret = 0;
+    std::size_t i = 0;
+    for (; i < s.size(); i++)
+    {
+        auto c = s[i];
+        unsigned digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;
+        ret = ret * 16 + digit;
+    }
+    s.remove_prefix(i);
+    return ret;
+}
+
+inline std::uint64_t parse_dec(std::string_view& s)
+{
+    std::uint64_t ret = 0;
+    std::size_t i = 0;
+    for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; i++)
+        ret = ret * 10 + (s[i] - '0');
+    s.remove_prefix(i);
+    return ret;
+}
+
+} // namespace
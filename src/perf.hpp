@@ -6,11 +6,27 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include <linux/perf_event.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <asm/unistd.h>
 #include <sys/mman.h>
 
+#include "events.hpp"
+#include "sample.hpp"
+
 namespace
 {
 
@@ -27,118 +43,365 @@ long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
 }
 
 /**
- * Advance the pointer by bytes.
+ * Reads records from the ring shared with the kernel: a metadata page
+ * followed by the data part which is a power of two in size.
+ *
+ * Records are handed out where they lie in the ring, without copying. Only
+ * the one which wraps around the end of the ring is put together in a bounce
+ * buffer first. The kernel is told about the consumed space in batches, not
+ * after every record.
  */
-template<class A, class B>
-auto trivial_pointer_advance(A a, B b)
+struct ring_reader
 {
-    char* ca = reinterpret_cast<char*>(a);
-    return reinterpret_cast<A>(ca + b);
+    ring_reader(perf_event_mmap_page* metadata, char* data, std::size_t size)
+        : _metadata(metadata), _data(data), _mask(size - 1), _tail(metadata->data_tail)
+    {
+        assert((size & _mask) == 0);
+    }
+
+    /**
+     * Calls `f` with every record written so far. The record is followed by
+     * its body and both are only valid during the call.
+     */
+    template<class F>
+    void read(F&& f)
+    {
+        // man says that after reading data_head, rmb should be issued
+        const auto head = __atomic_load_n(&_metadata->data_head, __ATOMIC_ACQUIRE);
+
+        // give the space back to the kernel a few times per full ring
+        const auto batch = (_mask + 1) / 4;
+        auto released = _tail;
+
+        while (_tail < head)
+        {
+            const auto offset = _tail & _mask;
+
+            // records are 8 bytes aligned so at least the header is never wrapped
+            auto header = reinterpret_cast<const perf_event_header*>(_data + offset);
+            const std::size_t size = header->size;
+
+            if (offset + size > _mask + 1)
+            {
+                const auto size_at_the_bottom = _mask + 1 - offset;
+                ::memcpy(_bounce, _data + offset, size_at_the_bottom);
+                ::memcpy(_bounce + size_at_the_bottom, _data, size - size_at_the_bottom);
+                header = reinterpret_cast<const perf_event_header*>(_bounce);
+            }
+
+            f(*header);
+            _tail += size;
+
+            if (_tail - released >= batch)
+            {
+                release();
+                released = _tail;
+            }
+        }
+
+        // we are done with the reading so we can write the tail to let the kernel know
+        // that it can continue with writes
+        release();
+    }
+
+private:
+    void release()
+    {
+        __atomic_store_n(&_metadata->data_tail, _tail, __ATOMIC_RELEASE);
+    }
+
+    perf_event_mmap_page* _metadata;
+    char* _data;
+    std::uint64_t _mask;
+    std::uint64_t _tail;
+
+    // a record is never bigger than what fits in perf_event_header::size
+    alignas(8) char _bounce[1 << 16];
+};
+
+/**
+ * Body of the record which follows its header.
+ */
+inline const char* record_body(const perf_event_header& header)
+{
+    return reinterpret_cast<const char*>(&header + 1);
 }
 
-struct cyclic_buffer_view
+/**
+ * Current time of the clock used for sample timestamps.
+ */
+inline std::uint64_t perf_clock_now()
 {
-    cyclic_buffer_view(char* start, std::size_t size)
-        : _start(start), _pointer(start), _size(size), _read_size(0)
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::uint64_t(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+using sample_t = poor_perf::sample<PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU>;
+static_assert(sizeof(sample_t) == 32, "samples are expected to be as compact as they are in the ring");
+
+using callchain_sample_t = poor_perf::sample<sample_t::type | PERF_SAMPLE_CALLCHAIN>;
+
+/**
+ * Attributes of the event which is being sampled, with `max_stack` other than
+ * zero samples carry call chains of at most that many frames.
+ */
+inline perf_event_attr sampling_attr(const poor_perf::sampling_spec& spec = {}, std::uint16_t max_stack = 0)
+{
+    const auto& event = spec.events.sampled();
+
+    perf_event_attr pe{};
+    pe.type = event.type;
+    pe.size = sizeof(perf_event_attr);
+    pe.config = event.config;
+    pe.sample_type = sample_t::type;
+    pe.disabled = 1;
+    pe.exclude_kernel = 0;
+    pe.exclude_hv = 1;
+
+    if (const auto period = spec.effective_period())
+        pe.sample_period = period;
+    else
     {
+        pe.sample_freq = spec.frequency;
+        pe.freq = 1;
     }
 
-    template<class T>
-    T read()
+    if (max_stack)
+    {
+        // kernel and user frames, the latter only from code with frame pointers
+        pe.sample_type = callchain_sample_t::type;
+        pe.sample_max_stack = max_stack;
+    }
+
+    // the events counted along with it are read all at once, see `perf_session::read_counts`
+    pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // samples from different cpus are merged by their timestamps so they
+    // have to come from a clock we can read from user space as well
+    pe.use_clockid = 1;
+    pe.clockid = CLOCK_MONOTONIC;
+    return pe;
+}
+
+/**
+ * Attributes of an event which is only counted, in the group of the sampled
+ * one, so it starts and stops along with it.
+ */
+inline perf_event_attr counting_attr(const poor_perf::perf_event_spec& event)
+{
+    perf_event_attr pe{};
+    pe.type = event.type;
+    pe.size = sizeof(perf_event_attr);
+    pe.config = event.config;
+    pe.exclude_hv = 1;
+
+    // the kernel wants all events of a group on the same clock
+    pe.use_clockid = 1;
+    pe.clockid = CLOCK_MONOTONIC;
+    return pe;
+}
+
+/**
+ * Attributes of the events of `spec` which are counted along with the
+ * sampled one.
+ */
+inline std::vector<perf_event_attr> counting_attrs(const poor_perf::sampling_spec& spec)
+{
+    std::vector<perf_event_attr> ret;
+    for (std::size_t i = 1; i < spec.events.size(); i++)
+        ret.push_back(counting_attr(spec.events.events[i]));
+    return ret;
+}
+
+/**
+ * Replaces the events which need hardware counters when there are none,
+ * like in virtual machines without a virtual PMU: the sampled one by
+ * cpu-clock, the counted ones are dropped. Returns a line for every one
+ * replaced or dropped, nothing when all of them can be opened on `cpu`.
+ */
+inline std::vector<std::string> fall_back_to_software(poor_perf::sampling_spec& spec, std::size_t cpu)
+{
+    auto missing = [cpu](perf_event_attr attr)
     {
-        // value wraps around cyclic buffer
-        if (_pointer + sizeof(T) > _start + _size)
+        auto fd = perf_event_open(&attr, -1, cpu, -1, 0);
+        if (fd != -1)
         {
-            const auto size_at_the_bottom = _start + _size - _pointer;
-            const auto remainder_size = sizeof(T) - size_at_the_bottom;
-            T value;
-            ::memcpy(&value, _pointer, size_at_the_bottom);
-            ::memcpy(trivial_pointer_advance(&value, size_at_the_bottom), _start, remainder_size);
-            _pointer = _start + remainder_size;
-            _read_size += sizeof(T);
-            return value;
+            ::close(fd);
+            return false;
         }
 
-        auto old = _pointer;
-        _pointer += sizeof(T);
-        _read_size += sizeof(T);
-        return *reinterpret_cast<T*>(old);
+        // there is no PMU which would know the event, or it cannot sample
+        return attr.type == PERF_TYPE_HARDWARE && (errno == ENOENT || errno == ENODEV || errno == EOPNOTSUPP);
+    };
+
+    std::vector<std::string> ret;
+    auto& events = spec.events.events;
+
+    if (missing(sampling_attr(spec)))
+    {
+        ret.push_back("no hardware counters for " + events.front().name + ", sampling cpu-clock instead");
+        events.front() = poor_perf::cpu_clock_event();
     }
 
-    void skip(std::size_t size)
+    for (std::size_t i = 1; i < events.size();)
     {
-        // value wraps around cyclic buffer
-        if (_pointer + size > _start + _size)
+        if (!missing(counting_attr(events[i])))
         {
-            const auto size_at_the_bottom = _start + _size - _pointer;
-            const auto remainder_size = size - size_at_the_bottom;
-            _pointer = _start + remainder_size;
-            _read_size += size;
-            return;
+            i++;
+            continue;
         }
 
-        _pointer += size;
-        _read_size += size;
+        ret.push_back("no hardware counters for " + events[i].name + ", it is not counted");
+        events.erase(events.begin() + i);
     }
+    return ret;
+}
+
+/**
+ * Attributes of a dummy event which never samples anything but delivers
+ * mmap2, comm, fork and exit records so we can follow processes as they come
+ * and go. Those are not requested from the sampling event, one source of them
+ * is enough.
+ */
+inline perf_event_attr tracking_attr(std::size_t data_pages)
+{
+    perf_event_attr pe{};
+    pe.type = PERF_TYPE_SOFTWARE;
+    pe.size = sizeof(perf_event_attr);
+    pe.config = PERF_COUNT_SW_DUMMY;
+    pe.sample_period = 1;
+    pe.disabled = 1;
+    pe.mmap = 1;
+    pe.mmap2 = 1;
+    pe.comm = 1;
+    pe.comm_exec = 1;
+    pe.task = 1;
+
+    // every record ends with pid, tid and time, see `record_time`
+    pe.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+    pe.sample_id_all = 1;
+    pe.use_clockid = 1;
+    pe.clockid = CLOCK_MONOTONIC;
+
+    // these are rare, do not wake up for every single one of them
+    pe.watermark = 1;
+    pe.wakeup_watermark = sysconf(_SC_PAGESIZE) * data_pages / 4;
+    return pe;
+}
 
-    auto total_read_size() const
+/**
+ * What the kernel could not deliver through the ring.
+ */
+struct ring_stats
+{
+    // samples dropped because the ring was full
+    std::uint64_t lost = 0;
+
+    // how many times the sampling rate was throttled by the kernel
+    std::uint64_t throttled = 0;
+
+    ring_stats& operator+=(const ring_stats& other)
     {
-        return _read_size;
+        lost += other.lost;
+        throttled += other.throttled;
+        return *this;
     }
-
-private:
-    char* _start;
-    char* _pointer;
-    std::size_t _size;
-    std::size_t _read_size;
 };
 
-struct sample_t
+/**
+ * Decodes the record, a sample goes to `f` and any other record to `other`
+ * along with a pointer to its body, what the kernel could not deliver is
+ * counted in `stats`. `Type` has to be the sample type the event was opened
+ * with.
+ */
+template<std::uint64_t Type = sample_t::type, class F, class G>
+void decode_record(const perf_event_header& header, ring_stats& stats, F&& f, G&& other)
 {
-    constexpr static std::uint32_t type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU;
-    std::uint64_t ip;
-    std::uint32_t pid, tid;
-    std::uint64_t time;
-    std::uint32_t cpu, res;
-};
+    const auto body = record_body(header);
 
-struct perf_fd
+    switch (header.type)
+    {
+        case PERF_RECORD_SAMPLE:
+        {
+            if constexpr (poor_perf::sample<Type>::fixed_size)
+                assert(header.size == sizeof(header) + poor_perf::sample_fields::fixed_body_size(Type));
+            f(poor_perf::decode_sample<Type>(body));
+            break;
+        }
+        case PERF_RECORD_LOST:
+        {
+            struct
+            {
+                std::uint64_t id;
+                std::uint64_t lost;
+            } lost;
+
+            ::memcpy(&lost, body, sizeof(lost));
+            stats.lost += lost.lost;
+            break;
+        }
+        case PERF_RECORD_THROTTLE:
+        {
+            stats.throttled++;
+            break;
+        }
+        default:
+            other(header, body);
+    }
+}
+
+/**
+ * Decodes all records of the ring with `decode_record`.
+ */
+template<std::uint64_t Type = sample_t::type, class F, class G>
+void read_records(ring_reader& ring, ring_stats& stats, F&& f, G&& other)
 {
-    explicit perf_fd(std::size_t cpu)
-    {
-        perf_event_attr pe{};
-        pe.type = PERF_TYPE_HARDWARE;
-        pe.size = sizeof(perf_event_attr);
-        pe.config = PERF_COUNT_HW_CPU_CYCLES;
-        pe.sample_freq = 7000;
-        pe.sample_type = sample_t::type;
-        pe.disabled = 1;
-        pe.exclude_kernel = 0;
-        pe.exclude_hv = 1;
-        pe.mmap = 1;
-        pe.freq = 1;
+    ring.read([&](const perf_event_header& header) { decode_record<Type>(header, stats, f, other); });
+}
 
+/**
+ * Opens the event on the cpu and maps its ring: one metadata page followed by
+ * `data_pages`, which has to be a power of two. It counts once it is enabled.
+ */
+struct perf_fd
+{
+    perf_fd(perf_event_attr pe, std::size_t cpu, std::size_t data_pages)
+    {
         _fd = perf_event_open(&pe, -1, cpu, -1, 0);
 
         if (_fd == -1)
             throw std::runtime_error("perf_event_open failed, perhaps you do not have enough permissions");
 
-        std::size_t mmap_size = sysconf(_SC_PAGESIZE) * 2;
+        _mmap_size = sysconf(_SC_PAGESIZE) * (1 + data_pages);
 
-        _buffer = reinterpret_cast<char*>(::mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0));
+        _buffer = reinterpret_cast<char*>(::mmap(NULL, _mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0));
         if (_buffer == MAP_FAILED)
+        {
+            ::close(_fd);
             throw std::runtime_error("mmap failed, I did never wonder why would it fail");
-
-        ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
-        ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
     }
 
+    perf_fd(const perf_fd&) = delete;
+    perf_fd& operator=(const perf_fd&) = delete;
+
     ~perf_fd()
     {
         ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+        ::munmap(_buffer, _mmap_size);
         ::close(_fd);
     }
 
+    /**
+     * Along with the rest of its group.
+     */
+    void enable()
+    {
+        ioctl(_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
     char* buffer()
     {
         return _buffer;
@@ -152,45 +415,109 @@ struct perf_fd
 private:
     int _fd;
     char* _buffer;
+    std::size_t _mmap_size;
 };
 
 struct perf_session
 {
-    perf_session(std::size_t cpu)
-        : _fd{cpu},
-          _metadata(reinterpret_cast<perf_event_mmap_page*>(_fd.buffer())),
-          _data_view{_fd.buffer() + _metadata->data_offset, _metadata->data_size}
+    perf_session(std::size_t cpu, std::size_t data_pages)
+        : perf_session(sampling_attr(), cpu, data_pages)
     {
     }
 
-    template<class F>
-    void read_some(F&& f)
+    /**
+     * The `counted` events are added to the group of the sampled one, they
+     * are read with `read_counts`.
+     */
+    perf_session(const perf_event_attr& attr, std::size_t cpu, std::size_t data_pages,
+        const std::vector<perf_event_attr>& counted = {})
+        : _fd{attr, cpu, data_pages},
+          _ring{metadata(), _fd.buffer() + metadata()->data_offset, metadata()->data_size}
     {
-        // man says that after reading data_head, rmb should be issued
-        auto data_head = _metadata->data_head;
-        __sync_synchronize();
-
-        while (_data_view.total_read_size() < data_head)
+        // the kernel does not schedule events added to a group which is already enabled
+        for (auto member : counted)
         {
-            auto header = _data_view.read<perf_event_header>();
-
-            switch (header.type)
+            auto fd = perf_event_open(&member, -1, cpu, _fd.fd(), 0);
+            if (fd == -1)
             {
-                case PERF_RECORD_SAMPLE:
-                {
-                    auto sample = _data_view.read<sample_t>();
-                    assert(header.size == sizeof(header) + sizeof(sample_t));
-                    f(sample);
-                    break;
-                }
-                default:
-                    _data_view.skip(header.size - sizeof(perf_event_header));
+                close_counters();
+                throw std::runtime_error{"could not count event " + std::to_string(member.config) + " of type " +
+                    std::to_string(member.type) + " on cpu " + std::to_string(cpu)};
             }
+            _counters.push_back(fd);
         }
+        _fd.enable();
+    }
 
-        // we are done with the reading so we can write the tail to let the kernel know
-        // that it can continue with writes
-        _metadata->data_tail = _data_view.total_read_size();
+    perf_session(const perf_session&) = delete;
+    perf_session& operator=(const perf_session&) = delete;
+
+    ~perf_session()
+    {
+        close_counters();
+    }
+
+    /**
+     * Counts of the sampled event and of the ones added to its group, in
+     * that order, read all at once. When the group did not fit into the
+     * counters all the time, they are scaled to the time it was enabled.
+     */
+    std::vector<std::uint64_t> read_counts() const
+    {
+        std::vector<std::uint64_t> buffer(3 + 1 + _counters.size());
+        const auto n = ::read(_fd.fd(), buffer.data(), buffer.size() * sizeof(std::uint64_t));
+        if (n < 3 * std::int64_t(sizeof(std::uint64_t)))
+            return std::vector<std::uint64_t>(1 + _counters.size());
+
+        // nr, time enabled and running, then the values
+        const auto nr = std::min<std::size_t>(buffer[0], buffer.size() - 3);
+        const auto enabled = buffer[1];
+        const auto running = buffer[2];
+
+        std::vector<std::uint64_t> ret(1 + _counters.size());
+        for (std::size_t i = 0; i < nr && i < ret.size(); i++)
+            ret[i] = running ? std::uint64_t(double(buffer[3 + i]) * enabled / running) : 0;
+        return ret;
+    }
+
+    /**
+     * From now on, the raw records read from the ring are passed to `f` as
+     * well, all of them at once after every read.
+     */
+    void capture_to(std::function<void(std::string_view)> f)
+    {
+        _capture = std::move(f);
+    }
+
+    /**
+     * Reads what the kernel has written so far, samples go to `f` and all
+     * other records to `other` along with a pointer to their body. `Type` has
+     * to be the sample type the event was opened with.
+     */
+    template<std::uint64_t Type = sample_t::type, class F, class G>
+    void read_some(F&& f, G&& other)
+    {
+        if (!_capture)
+        {
+            read_records<Type>(_ring, _stats, std::forward<F>(f), std::forward<G>(other));
+            return;
+        }
+
+        _captured.clear();
+        _ring.read([&](const perf_event_header& header)
+        {
+            _captured.append(reinterpret_cast<const char*>(&header), header.size);
+            decode_record<Type>(header, _stats, f, other);
+        });
+
+        if (!_captured.empty())
+            _capture(_captured);
+    }
+
+    template<std::uint64_t Type = sample_t::type, class F>
+    void read_some(F&& f)
+    {
+        read_some<Type>(std::forward<F>(f), [](const perf_event_header&, const char*) {});
     }
 
     auto fd() const
@@ -198,9 +525,45 @@ struct perf_session
         return _fd.fd();
     }
 
+    /**
+     * Changes the sampling frequency of an event opened with one, or its
+     * period otherwise, it takes effect right away.
+     */
+    void set_rate(std::uint64_t rate)
+    {
+        if (ioctl(_fd.fd(), PERF_EVENT_IOC_PERIOD, &rate) == -1)
+            throw std::runtime_error{"could not change the sampling rate to " + std::to_string(rate)};
+    }
+
+    /**
+     * Returns what was lost since the last call.
+     */
+    ring_stats take_stats()
+    {
+        auto ret = _stats;
+        _stats = {};
+        return ret;
+    }
+
 private:
+    void close_counters()
+    {
+        for (auto fd : _counters)
+            ::close(fd);
+    }
+
+    perf_event_mmap_page* metadata()
+    {
+        return reinterpret_cast<perf_event_mmap_page*>(_fd.buffer());
+    }
+
     perf_fd _fd;
-    perf_event_mmap_page* _metadata;
-    cyclic_buffer_view _data_view;
+    ring_reader _ring;
+    ring_stats _stats;
+
+    std::function<void(std::string_view)> _capture;
+    std::string _captured;
+
+    std::vector<int> _counters;
 };
 
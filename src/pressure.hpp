@@ -0,0 +1,122 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace poor_perf
+{
+
+/**
+ * Cpu pressure file of the cgroup, or of the whole system when it is empty.
+ * Relative paths are taken from the root of the cgroup hierarchy.
+ */
+inline std::string cpu_pressure_path(const std::string& cgroup)
+{
+    if (cgroup.empty())
+        return "/proc/pressure/cpu";
+    if (cgroup[0] == '/')
+        return cgroup + "/cpu.pressure";
+    return "/sys/fs/cgroup/" + cgroup + "/cpu.pressure";
+}
+
+/**
+ * PSI trigger, the kernel makes its descriptor ready with EPOLLPRI when the
+ * tasks were stalled waiting for a cpu for at least `stall` out of some
+ * `window`, at most once per window.
+ *
+ * The kernel accepts windows from 500ms to 10s, only multiples of 2s
+ * without privileges.
+ */
+struct pressure_trigger
+{
+    pressure_trigger(const std::string& path, std::chrono::microseconds stall, std::chrono::microseconds window)
+        : _path(path), _window(window)
+    {
+        _fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (_fd == -1)
+            throw std::runtime_error{"could not open '" + path + "', is the kernel built with CONFIG_PSI?"};
+
+        // the terminating NUL is a part of what the kernel expects
+        const auto trigger = "some " + std::to_string(stall.count()) + " " + std::to_string(window.count());
+        if (::write(_fd, trigger.c_str(), trigger.size() + 1) == -1)
+        {
+            ::close(_fd);
+            throw std::runtime_error{"could not set trigger '" + trigger + "' on '" + path +
+                "', without CAP_SYS_RESOURCE the window has to be a multiple of 2s"};
+        }
+    }
+
+    pressure_trigger(const pressure_trigger&) = delete;
+    pressure_trigger& operator=(const pressure_trigger&) = delete;
+
+    ~pressure_trigger()
+    {
+        ::close(_fd);
+    }
+
+    int fd() const
+    {
+        return _fd;
+    }
+
+    const std::string& path() const
+    {
+        return _path;
+    }
+
+    /**
+     * The "some" line of the pressure file, empty when it cannot be read
+     * anymore because the cgroup was removed.
+     */
+    std::string current() const
+    {
+        char buffer[256];
+        auto n = ::pread(_fd, buffer, sizeof(buffer) - 1, 0);
+        if (n <= 0)
+            return {};
+
+        std::string ret{buffer, std::size_t(n)};
+        return ret.substr(0, ret.find('\n'));
+    }
+
+    /**
+     * To be called when an event loop saw the trigger fire, the event is
+     * gone once it was seen.
+     */
+    void fired()
+    {
+        _last_fired = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * Whether the trigger fired within the last window, checked without
+     * waiting, for when the descriptor is not in an event loop.
+     */
+    bool stalling()
+    {
+        pollfd p{_fd, POLLPRI, 0};
+        if (::poll(&p, 1, 0) == 1 && (p.revents & POLLPRI))
+            fired();
+        return std::chrono::steady_clock::now() - _last_fired < _window;
+    }
+
+private:
+    std::string _path;
+    std::chrono::microseconds _window;
+    std::chrono::steady_clock::time_point _last_fired;
+    int _fd;
+};
+
+} // namespace
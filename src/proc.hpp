@@ -6,85 +6,181 @@
  */
 #pragma once
 
-#include <string>
-#include <sstream>
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
-#include <cctype>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/sysmacros.h>
 
-#include <boost/filesystem.hpp>
+#include "parse.hpp"
+#include "region_index.hpp"
+#include "elf.hpp"
+#include "cpu_list.hpp"
+#include "utils.hpp"
 
 namespace poor_perf
 {
 
+/**
+ * Symbols from /proc/kallsyms kept as a struct of arrays: sorted addresses,
+ * offsets of the names in one blob and ids of the modules, which are few.
+ */
 struct kernel_symbols
 {
-    struct kernel_symbol
+    /**
+     * Refers to the strings owned by the table.
+     */
+    struct symbol_ref
     {
-        kernel_symbol(const std::string& s)
-        {
-            std::stringstream{s} >> std::hex >> addr >> mode >> name >> module;
-        }
+        std::uintptr_t addr;
+        std::string_view name;
+        std::string_view module;
+    };
 
-        kernel_symbol()
-        {
-        }
+    kernel_symbols() = default;
 
-        std::uintptr_t addr;
-        char mode;
-        std::string name;
-        std::string module = "<kernelmain>";
+    explicit kernel_symbols(const std::string& path)
+    {
+        load(read_file(path, 1 << 20));
+    }
 
-        bool operator<(const kernel_symbol& other) const
-        {
-            return addr < other.addr;
-        }
-    };
+    /**
+     * Symbols from the contents of a kallsyms file, e.g. a captured one.
+     */
+    static kernel_symbols from_text(std::string_view contents)
+    {
+        kernel_symbols ret;
+        ret.load(contents);
+        return ret;
+    }
 
-    kernel_symbols()
+    symbol_ref find(std::uintptr_t ip) const
     {
-        std::ifstream f{"/proc/kallsyms"};
-        std::string line;
-        while (std::getline(f, line))
-            _symbols.emplace_back(line);
-        std::sort(_symbols.begin(), _symbols.end());
-        std::cerr << "read " << _symbols.size() << " kernel symbols\n";
+        if (_addrs.empty())
+            return {ip, "-", "<nokernel>"};
+
+        auto it = std::upper_bound(std::next(_addrs.begin()), _addrs.end(), ip);
+
+        if (it == _addrs.end())
+            return {ip, "-", "<nokernel>"};
+
+        auto i = std::distance(_addrs.begin(), it) - 1;
+        return {_addrs[i], _names.data() + _name_offsets[i], _modules[_module_ids[i]]};
+    }
+
+    auto size() const
+    {
+        return _addrs.size();
     }
 
-    kernel_symbol find(std::uintptr_t ip) const
+private:
+    void load(std::string_view contents)
     {
-        auto less = [](std::uintptr_t a, kernel_symbol b)
+        struct parsed
         {
-            return a < b.addr;
+            std::uintptr_t addr;
+            std::uint32_t name;
+            std::uint16_t module;
         };
 
-        auto it = std::upper_bound(std::next(_symbols.begin()), _symbols.end(), ip, less);
+        std::vector<parsed> symbols;
+        std::unordered_map<std::string_view, std::uint16_t> module_ids;
+        _modules.push_back("<kernelmain>");
+
+        // lines look like "ffffffffc0ffd000 t intel_prepare_plane_fb\t[i915]"
+        std::string_view text = contents, line;
+        while (next_line(text, line))
+        {
+            parsed p;
+            p.addr = parse_hex(line);
+            next_field(line);
+            auto name = next_field(line);
+            auto module = next_field(line);
+
+            p.name = static_cast<std::uint32_t>(_names.size());
+            _names.append(name);
+            _names.push_back('\0');
+
+            p.module = 0;
+            if (!module.empty())
+            {
+                auto it = module_ids.emplace(module, static_cast<std::uint16_t>(_modules.size())).first;
+                if (it->second == _modules.size())
+                    _modules.emplace_back(module);
+                p.module = it->second;
+            }
+
+            symbols.push_back(p);
+        }
 
-        if (it == _symbols.end())
+        std::stable_sort(symbols.begin(), symbols.end(), [](const auto& a, const auto& b) { return a.addr < b.addr; });
+
+        _addrs.reserve(symbols.size());
+        _name_offsets.reserve(symbols.size());
+        _module_ids.reserve(symbols.size());
+        for (const auto& p : symbols)
         {
-            kernel_symbol ksym;
-            ksym.addr = ip;
-            ksym.module = "<nokernel>";
-            ksym.name = "-";
-            return ksym;
+            _addrs.push_back(p.addr);
+            _name_offsets.push_back(p.name);
+            _module_ids.push_back(p.module);
         }
 
-        return *std::prev(it);
+        std::cerr << "read " << _addrs.size() << " kernel symbols\n";
     }
 
-private:
-    std::vector<kernel_symbol> _symbols;
+    std::vector<std::uintptr_t> _addrs;
+    std::vector<std::uint32_t> _name_offsets;
+    std::vector<std::uint16_t> _module_ids;
+
+    // names separated by NULs
+    std::string _names;
+    std::vector<std::string> _modules;
 };
 
 struct region_t
 {
-    explicit region_t(const std::string& s)
+    region_t(std::uintptr_t start, std::uintptr_t end, std::string perms, std::uintptr_t offset, std::string pathname,
+        std::uint64_t dev = 0, std::uint64_t inode = 0)
+        : start(start), end(end), perms(std::move(perms)), offset(offset), pathname(std::move(pathname)), dev(dev),
+          inode(inode)
     {
-        std::istringstream ss{s};
-        char _;
-        std::string _s;
-        ss >> std::hex >> start >> _ >> end >> perms >> offset >> _s >> _s >> pathname;
+    }
+
+    /**
+     * Parses a line of /proc/$PID/maps, like:
+     * 56373c46a000-56373c46b000 r-xp 0000000a 103:02 10628889    /usr/bin/python2.7
+     */
+    explicit region_t(std::string_view s)
+    {
+        start = parse_hex(s);
+        s.remove_prefix(std::min<std::size_t>(1, s.size()));
+        end = parse_hex(s);
+        perms = next_field(s);
+        skip_spaces(s);
+        offset = parse_hex(s);
+
+        // device as "major:minor" in hex and inode of the file which is mapped
+        skip_spaces(s);
+        const auto major = parse_hex(s);
+        s.remove_prefix(std::min<std::size_t>(1, s.size()));
+        const auto minor = parse_hex(s);
+        dev = makedev(major, minor);
+        skip_spaces(s);
+        inode = parse_dec(s);
+
+        // pathname can contain spaces, it is the rest of the line
+        skip_spaces(s);
+        constexpr std::string_view deleted = " (deleted)";
+        if (s.size() >= deleted.size() && s.substr(s.size() - deleted.size()) == deleted)
+            s.remove_suffix(deleted.size());
+        pathname = s;
     }
 
     std::uintptr_t start;
@@ -93,6 +189,10 @@ struct region_t
     std::uintptr_t offset;
     std::string pathname;
 
+    // of the file which was mapped, which is not necessarily the one at the pathname now
+    std::uint64_t dev = 0;
+    std::uint64_t inode = 0;
+
     bool contains(std::uintptr_t ip) const
     {
         // TODO: not sure about this range
@@ -105,58 +205,156 @@ struct region_t
     }
 };
 
+/**
+ * Strings refer to `running_processes_snapshot` and stay valid until it is
+ * changed.
+ */
 struct symbol_t
 {
-    std::string comm;
-    std::string pathname;
+    std::string_view comm;
+    std::string_view pathname;
     std::uintptr_t addr;
 
     // in case of kallsyms, we have the name of the symbol
-    std::string name;
+    std::string_view name;
 };
 
-auto read_maps(const std::string& path)
+/**
+ * The kernel lives in the upper half of the address space on 64 bit linux.
+ */
+inline bool is_kernel_address(std::uintptr_t addr)
+{
+    return addr >> (sizeof(addr) * 8 - 1);
+}
+
+/**
+ * Executable regions from the contents of a maps file.
+ */
+inline std::vector<region_t> parse_maps(std::string_view text)
 {
     std::vector<region_t> ret;
-    std::ifstream f{path};
-    std::string line;
-    while (std::getline(f, line))
+    std::string_view line;
+    while (next_line(text, line))
     {
-        region_t e{line};
-        if (e.exec())
-            ret.push_back(e);
+        // only executable ones are interesting, do not bother parsing the rest
+        auto perms = line.find(' ');
+        if (perms == std::string_view::npos || perms + 3 >= line.size() || line[perms + 3] != 'x')
+            continue;
+
+        ret.emplace_back(line);
     }
     return ret;
 }
 
-bool is_number(const std::string& s)
+inline auto read_maps(const std::string& path)
+{
+    return parse_maps(read_file(path));
+}
+
+inline std::string read_first_line(const std::string& path)
 {
-    return std::all_of(s.begin(), s.end(), [](char c) { return std::isdigit(c); });
+    auto ret = read_file(path, 256);
+    auto eol = ret.find('\n');
+    if (eol != std::string::npos)
+        ret.resize(eol);
+    return ret;
 }
 
-std::string read_first_line(const std::string& path)
+/**
+ * Pids of all processes found in /proc.
+ */
+inline std::vector<std::uint32_t> list_pids()
 {
-    std::ifstream f{path};
-    std::string line;
-    std::getline(f, line);
-    return line;
+    std::vector<std::uint32_t> ret;
+
+    DIR* dir = ::opendir("/proc");
+    if (!dir)
+        throw std::runtime_error{"could not open /proc"};
+
+    while (auto entry = ::readdir(dir))
+    {
+        std::string_view name{entry->d_name};
+        auto rest = name;
+        auto pid = parse_dec(rest);
+        if (!name.empty() && rest.empty())
+            ret.push_back(static_cast<std::uint32_t>(pid));
+    }
+
+    ::closedir(dir);
+    return ret;
 }
 
+/**
+ * Process as it was found in /proc.
+ */
+struct scanned_process
+{
+    std::uint32_t pid;
+    std::string comm;
+    std::vector<region_t> maps;
+};
+
 struct process_info
 {
     std::string comm = "??";
-    std::vector<region_t> maps;
+    region_index maps;
+
+    // exit was reported but the process might still be sampled while it is being torn down
+    bool exited = false;
+};
+
+struct pid_address_hash
+{
+    std::size_t operator()(const std::pair<std::uint32_t, std::uintptr_t>& key) const
+    {
+        return std::hash<std::uintptr_t>{}(key.second ^ (std::uintptr_t(key.first) << 47));
+    }
 };
 
+using region_hits = std::unordered_map<std::pair<std::uint32_t, std::uintptr_t>, region_index::entry, pid_address_hash>;
+
+/**
+ * Table of processes and kernel symbols used to symbolize samples.
+ *
+ * It is loaded in the background, so the profiler can open its perf sessions
+ * and start sampling meanwhile. The first call which needs the data waits
+ * for it.
+ */
 struct running_processes_snapshot
 {
     running_processes_snapshot()
     {
-        load_processes_map();
+        _loading = std::async(std::launch::async, [this] { load(); });
+    }
+
+    /**
+     * Snapshot of what was found elsewhere, e.g. in a capture.
+     */
+    running_processes_snapshot(kernel_symbols kernel, std::vector<scanned_process> processes)
+        : _kernel_symbols(std::move(kernel))
+    {
+        add(processes);
+    }
+
+    ~running_processes_snapshot()
+    {
+        if (_loading.valid())
+            _loading.wait();
+    }
+
+    /**
+     * Blocks until the snapshot is taken, rethrows if that failed.
+     */
+    void wait_until_loaded() const
+    {
+        if (_loading.valid())
+            _loading.get();
     }
 
     symbol_t find_symbol(std::uint32_t pid, std::uintptr_t ip) const
     {
+        wait_until_loaded();
+
         if (pid == 0)
         {
             // https://en.wikipedia.org/wiki/Parent_process#Unix-like_systems
@@ -175,7 +373,7 @@ struct running_processes_snapshot
 
         if (proc_it == _processes.end())
         {
-            // this process was probably started after poor-perf
+            // we did not see this process in /proc nor any record about it
             symbol_t ret;
             ret.comm = "<no maps>";
             ret.pathname = "-";
@@ -190,10 +388,19 @@ struct running_processes_snapshot
         ret.comm = proc.comm;
         ret.name = "-";
 
-        auto region = std::find_if(proc.maps.begin(), proc.maps.end(), [&](const auto& r) { return r.contains(ip); });
+        auto region = proc.maps.find(ip);
 
-        if (region == proc.maps.end())
+        if (!region)
         {
+            // user space address which is not mapped, e.g. a bogus frame of
+            // a call chain through code without frame pointers
+            if (!is_kernel_address(ip))
+            {
+                ret.pathname = "-";
+                ret.addr = ip;
+                return ret;
+            }
+
             // last chance is to get it from kallsyms
             auto s = _kernel_symbols.find(ip);
             ret.pathname = s.module;
@@ -202,32 +409,207 @@ struct running_processes_snapshot
             return ret;
         }
 
-        ret.pathname = region->pathname;
+        ret.pathname = _pathnames.get(region->pathname);
         ret.addr = ip - region->start + region->offset;
+        _hits.emplace(std::make_pair(pid, region->start), *region);
+
+        if (auto elf = file_symbols(pid, *region))
+        {
+            auto name = elf->find(ret.addr);
+            if (!name.empty())
+                ret.name = name;
+        }
+        return ret;
+    }
+
+    /**
+     * User space regions symbolized since the last call, by pid and start.
+     */
+    region_hits take_hits()
+    {
+        region_hits ret;
+        std::swap(ret, _hits);
         return ret;
     }
 
+    const std::string& pathname(std::uint32_t id) const
+    {
+        return _pathnames.get(id);
+    }
+
+    /**
+     * Symbols of the file which process `pid` mapped at `region`, never those
+     * of a different file which replaced it at the same path. nullptr when it
+     * cannot be read or it is not an ELF file.
+     */
+    const elf_symbols* file_symbols(std::uint32_t pid, const region_index::entry& region) const
+    {
+        const auto& path = _pathnames.get(region.pathname);
+        if (region.inode == 0)
+            return _elf_symbols.get(region.pathname, path);
+        return _elf_symbols.get(region.dev, region.inode, path, pid, region.start, region.end);
+    }
+
+    /**
+     * Files whose mappings are not known are looked up again by their paths
+     * the next time they are needed, in case they were replaced, and files
+     * which could not be read are tried again. Symbols of the files which did
+     * not change are not parsed again.
+     */
+    void revalidate_symbols()
+    {
+        _elf_symbols.forget_paths();
+    }
+
+    void on_mmap(std::uint32_t pid, const region_t& region)
+    {
+        wait_until_loaded();
+        if (region.exec())
+            _processes[pid].maps.add(index_entry(region));
+    }
+
+    void on_comm(std::uint32_t pid, std::string comm, bool exec)
+    {
+        wait_until_loaded();
+        auto& proc = _processes[pid];
+        proc.comm = std::move(comm);
+
+        // new executable, the mappings of the new image are reported after this
+        if (exec)
+            proc.maps.clear();
+    }
+
+    void on_fork(std::uint32_t pid, std::uint32_t ppid)
+    {
+        wait_until_loaded();
+        // it might be that we know about the child already, either from the
+        // initial scan or because its records were read from a different cpu
+        // earlier than the fork itself
+        auto child = _processes.find(pid);
+        if (child != _processes.end() && !child->second.exited)
+            return;
+
+        auto parent = _processes.find(ppid);
+        _processes[pid] = parent == _processes.end() ? process_info{} : parent->second;
+        _processes[pid].exited = false;
+    }
+
+    void on_exit(std::uint32_t pid)
+    {
+        wait_until_loaded();
+        auto it = _processes.find(pid);
+        if (it == _processes.end())
+            return;
+
+        it->second.exited = true;
+        _exited.push_back(pid);
+    }
+
+    /**
+     * Forgets about processes which have exited, to be called when there are
+     * no more samples to symbolize.
+     */
+    void remove_exited()
+    {
+        wait_until_loaded();
+        for (auto pid : _exited)
+        {
+            auto it = _processes.find(pid);
+            if (it != _processes.end() && it->second.exited)
+                _processes.erase(it);
+        }
+        _exited.clear();
+    }
+
+    auto size() const
+    {
+        wait_until_loaded();
+        return _processes.size();
+    }
+
 private:
+    void load()
+    {
+        auto kernel = std::async(std::launch::async, []
+        {
+            run_as_helper();
+            return kernel_symbols{"/proc/kallsyms"};
+        });
+
+        load_processes_map();
+        _kernel_symbols = kernel.get();
+    }
+
+    /**
+     * Helper threads inherit the realtime priority of the profiler, they
+     * would starve its cpu while they parse, and its affinity to a single
+     * cpu, they would not run in parallel then.
+     */
+    static void run_as_helper()
+    {
+        set_this_thread_into_normal();
+        set_this_thread_affinity(online_cpus());
+    }
+
     void load_processes_map()
     {
-        for (const auto& process_directory : boost::filesystem::directory_iterator{"/proc/"})
+        const auto pids = list_pids();
+        const auto workers = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+
+        std::atomic<std::size_t> next{0};
+        std::vector<std::vector<scanned_process>> scanned(workers);
+
+        auto scan = [&](std::vector<scanned_process>& out)
         {
-            auto directory_name = process_directory.path().filename().string();
-            if (is_number(directory_name))
+            run_as_helper();
+
+            for (auto i = next++; i < pids.size(); i = next++)
             {
-                std::uint32_t pid;
-                std::stringstream{directory_name} >> pid;
-                process_info p;
-                p.comm = read_first_line((process_directory.path() / "comm").string());
-                p.maps = read_maps((process_directory.path() / "maps").string());
-                _processes.emplace(pid, p);
+                const auto dir = "/proc/" + std::to_string(pids[i]);
+                out.push_back({pids[i], read_first_line(dir + "/comm"), read_maps(dir + "/maps")});
             }
-        }
+        };
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < workers; i++)
+            threads.emplace_back(scan, std::ref(scanned[i]));
+        scan(scanned[0]);
+        for (auto& t : threads)
+            t.join();
+
+        // pathnames are interned here so the workers do not need to share the table
+        for (auto& part : scanned)
+            add(part);
+
         std::cerr << "took map snapshot of " << _processes.size() << " running processes\n";
     }
 
+    void add(std::vector<scanned_process>& processes)
+    {
+        for (auto& s : processes)
+        {
+            process_info p;
+            p.comm = std::move(s.comm);
+            for (const auto& region : s.maps)
+                p.maps.add(index_entry(region));
+            _processes.emplace(s.pid, std::move(p));
+        }
+    }
+
+    region_index::entry index_entry(const region_t& region)
+    {
+        return {region.start, region.end, region.offset, _pathnames.intern(region.pathname), region.dev, region.inode};
+    }
+
     std::unordered_map<std::uint32_t, process_info> _processes;
+    std::vector<std::uint32_t> _exited;
+    string_table _pathnames;
     kernel_symbols _kernel_symbols;
+
+    // user space symbols are read when the samples need them
+    mutable elf_symbol_cache _elf_symbols;
+    mutable region_hits _hits;
+    mutable std::future<void> _loading;
 };
 
 } // namespace
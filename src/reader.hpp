@@ -0,0 +1,379 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "perf.hpp"
+#include "event_loop.hpp"
+#include "utils.hpp"
+#include "spsc_queue.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Sample as it is passed on to be written, with its call chain from the
+ * leaf to the root when it was asked for.
+ */
+struct profile_sample : sample_t
+{
+    std::vector<std::uint64_t> callchain;
+};
+
+/**
+ * Sample without its call chain.
+ */
+template<class Sample>
+sample_t leaf_of(const Sample& sample)
+{
+    sample_t ret;
+    ret.ip = sample.ip;
+    ret.pid = sample.pid;
+    ret.tid = sample.tid;
+    ret.time = sample.time;
+    ret.cpu = sample.cpu;
+    ret.res = sample.res;
+    return ret;
+}
+
+/**
+ * Samples read from the ring at once.
+ */
+struct sample_batch
+{
+    std::vector<sample_t> samples;
+
+    // call chains of all samples one after another, empty without them
+    std::vector<std::uint64_t> frames;
+    std::vector<std::uint32_t> depths;
+
+    // any sample which is read later will not be older than this
+    std::uint64_t watermark;
+
+    ring_stats stats;
+
+    // raw records the samples were decoded from, only when they are captured
+    std::string records;
+};
+
+/**
+ * What did not make it from the reader to the writer.
+ */
+struct reader_stats
+{
+    ring_stats ring;
+
+    // batches which did not fit into the queue because the writer fell behind
+    std::uint64_t dropped_batches = 0;
+    std::uint64_t dropped_samples = 0;
+};
+
+/**
+ * Drains the perf ring of a single cpu from its own thread pinned to that cpu.
+ *
+ * The thread inherits the scheduling policy of its creator so when the
+ * profiler runs as SCHED_FIFO, so do the readers. They do nothing but copy
+ * raw samples into a bounded lock-free queue, which is emptied by `collect`
+ * from a single thread. When that one falls behind, batches are dropped.
+ */
+struct cpu_reader
+{
+    // slots for batches, each one holds at most what fits into the ring
+    constexpr static std::size_t queue_capacity = 32;
+
+    /**
+     * The first event of `sampling` is sampled, the others are counted in
+     * its group. When there is `capture`, raw records travel through the
+     * queue along with their samples and `collect` passes them to it, so the
+     * reader thread never waits for it.
+     */
+    cpu_reader(std::size_t cpu, std::size_t data_pages, std::uint16_t max_stack, const sampling_spec& sampling,
+        volatile sig_atomic_t& signal_status, std::function<void(std::string_view)> capture = {})
+        : _cpu(cpu), _callchains(max_stack != 0),
+          _session{sampling_attr(sampling, max_stack), cpu, data_pages, counting_attrs(sampling)},
+          _signal_status(signal_status), _queue{queue_capacity}, _capture(std::move(capture))
+    {
+        if (_capture)
+        {
+            // records of a batch which was dropped are dropped with it
+            _session.capture_to([this](std::string_view records)
+            {
+                if (_filled)
+                    _filled->records.append(records);
+            });
+        }
+        _thread = std::thread{[this] { run(); }};
+    }
+
+    ~cpu_reader()
+    {
+        stop();
+    }
+
+    /**
+     * Stops the reader thread, whatever was left in the ring is drained before
+     * it returns.
+     */
+    void stop()
+    {
+        if (!_thread.joinable())
+            return;
+
+        _running.store(false, std::memory_order_relaxed);
+        _thread.join();
+    }
+
+    /**
+     * Moves all samples read so far to the back of `out` and returns the
+     * watermark: any sample which is read later will not be older than it.
+     * Raw records are passed to the capture first, when there is one.
+     */
+    std::uint64_t collect(std::deque<profile_sample>& out)
+    {
+        while (auto batch = _queue.front())
+        {
+            if (_capture && !batch->records.empty())
+                _capture(batch->records);
+
+            const auto* frames = batch->frames.data();
+            for (std::size_t i = 0; i < batch->samples.size(); i++)
+            {
+                out.push_back(profile_sample{batch->samples[i], {}});
+                if (!batch->depths.empty())
+                {
+                    out.back().callchain.assign(frames, frames + batch->depths[i]);
+                    frames += batch->depths[i];
+                }
+            }
+
+            _watermark = batch->watermark;
+            _stats.ring += batch->stats;
+            _queue.pop();
+        }
+        return _watermark;
+    }
+
+    auto cpu() const
+    {
+        return _cpu;
+    }
+
+    /**
+     * Sampling frequency, or period when it was opened with one. Can be
+     * called from any thread while the reader runs.
+     */
+    void set_rate(std::uint64_t rate)
+    {
+        _session.set_rate(rate);
+    }
+
+    /**
+     * Counts of the events of the group so far, can be called from any
+     * thread.
+     */
+    std::vector<std::uint64_t> counts() const
+    {
+        return _session.read_counts();
+    }
+
+    /**
+     * What was lost since the last call, to be called from the thread which
+     * collects the samples or once the reader is stopped.
+     */
+    reader_stats take_stats()
+    {
+        auto ret = _stats;
+        ret.dropped_batches = _dropped_batches.exchange(0, std::memory_order_relaxed);
+        ret.dropped_samples = _dropped_samples.exchange(0, std::memory_order_relaxed);
+        _stats = {};
+        return ret;
+    }
+
+private:
+    void run()
+    {
+        auto name = "poor-reader/" + std::to_string(_cpu);
+        set_this_thread_name(name.c_str());
+        set_this_thread_affinity(_cpu);
+
+        event_loop loop{_signal_status};
+        loop.add_fd(_session.fd());
+
+        // the kernel wakes us up only when the ring fills up, an idle cpu
+        // still publishes its watermark or the merge would wait for it
+        while (_running.load(std::memory_order_relaxed))
+            if (!loop.run_once([&](int) { drain(); }, std::chrono::milliseconds{100}))
+                drain();
+
+        drain();
+    }
+
+    void drain()
+    {
+        // take the time before looking at the ring, whatever is written there
+        // later will have a newer timestamp
+        auto now = perf_clock_now();
+
+        auto batch = _queue.back();
+        if (!batch)
+        {
+            // the ring has to be emptied anyway or the kernel starts losing samples
+            std::uint64_t samples = 0;
+            read_some([&](const auto&) { samples++; });
+            if (samples)
+            {
+                _dropped_batches.fetch_add(1, std::memory_order_relaxed);
+                _dropped_samples.fetch_add(samples, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        batch->samples.clear();
+        batch->frames.clear();
+        batch->depths.clear();
+        batch->records.clear();
+        _filled = batch;
+        read_some([&](const auto& sample)
+        {
+            if constexpr (std::is_same_v<std::decay_t<decltype(sample)>, callchain_sample_t>)
+            {
+                batch->samples.push_back(leaf_of(sample));
+                batch->frames.insert(batch->frames.end(), sample.ips, sample.ips + sample.nr);
+                batch->depths.push_back(sample.nr);
+            }
+            else
+                batch->samples.push_back(sample);
+        });
+        _filled = nullptr;
+        batch->watermark = now;
+        batch->stats = _session.take_stats();
+        _queue.push();
+    }
+
+    template<class F>
+    void read_some(F&& f)
+    {
+        if (_callchains)
+            _session.read_some<callchain_sample_t::type>(std::forward<F>(f));
+        else
+            _session.read_some(std::forward<F>(f));
+    }
+
+    std::size_t _cpu;
+    bool _callchains;
+    perf_session _session;
+    volatile sig_atomic_t& _signal_status;
+    std::atomic<bool> _running{true};
+    spsc_queue<sample_batch> _queue;
+    std::function<void(std::string_view)> _capture;
+
+    // batch which the reader thread is filling, the captured records go there
+    sample_batch* _filled = nullptr;
+
+    std::atomic<std::uint64_t> _dropped_batches{0};
+    std::atomic<std::uint64_t> _dropped_samples{0};
+    std::thread _thread;
+
+    // only touched by the collecting thread
+    std::uint64_t _watermark = 0;
+    reader_stats _stats;
+};
+
+/**
+ * Merges the per-cpu streams of samples, each already ordered by time, into
+ * a single time ordered stream.
+ */
+struct sample_merger
+{
+    // samples are timestamped in NMI context a moment before they get into
+    // the ring so the watermark is not followed to the last nanosecond
+    constexpr static std::uint64_t watermark_slack = 10000000u;
+
+    explicit sample_merger(std::size_t sources)
+        : _queues(sources), _watermarks(sources, 0)
+    {
+    }
+
+    std::deque<profile_sample>& queue(std::size_t source)
+    {
+        return _queues[source];
+    }
+
+    void set_watermark(std::size_t source, std::uint64_t watermark)
+    {
+        _watermarks[source] = watermark;
+    }
+
+    /**
+     * Passes on samples which are older than the watermarks of all sources,
+     * nothing older can come after them.
+     */
+    template<class F>
+    void pop_ready(F&& f)
+    {
+        auto limit = *std::min_element(_watermarks.begin(), _watermarks.end());
+        pop_until(limit > watermark_slack ? limit - watermark_slack : 0, std::forward<F>(f));
+    }
+
+    /**
+     * Passes on everything, to be used when the sources are stopped.
+     */
+    template<class F>
+    void pop_all(F&& f)
+    {
+        pop_until(std::numeric_limits<std::uint64_t>::max(), std::forward<F>(f));
+    }
+
+private:
+    template<class F>
+    void pop_until(std::uint64_t limit, F&& f)
+    {
+        // min heap of the queue heads
+        auto later = [this](std::size_t a, std::size_t b)
+        {
+            return _queues[a].front().time > _queues[b].front().time;
+        };
+
+        _heap.clear();
+        for (std::size_t i = 0; i < _queues.size(); i++)
+            if (!_queues[i].empty())
+                _heap.push_back(i);
+        std::make_heap(_heap.begin(), _heap.end(), later);
+
+        while (!_heap.empty())
+        {
+            std::pop_heap(_heap.begin(), _heap.end(), later);
+            auto& q = _queues[_heap.back()];
+
+            if (q.front().time >= limit)
+                break;
+
+            f(q.front());
+            q.pop_front();
+
+            if (q.empty())
+                _heap.pop_back();
+            else
+                std::push_heap(_heap.begin(), _heap.end(), later);
+        }
+    }
+
+    std::vector<std::deque<profile_sample>> _queues;
+    std::vector<std::uint64_t> _watermarks;
+    std::vector<std::size_t> _heap;
+};
+
+} // namespace
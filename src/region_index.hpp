@@ -0,0 +1,172 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace poor_perf
+{
+
+/**
+ * Strings shared by all processes, every distinct one is stored once and
+ * referred to by its id. Ids and references stay valid for the lifetime of
+ * the table.
+ */
+struct string_table
+{
+    std::uint32_t intern(std::string_view s)
+    {
+        auto it = _ids.find(s);
+        if (it != _ids.end())
+            return it->second;
+
+        auto id = static_cast<std::uint32_t>(_strings.size());
+        _strings.emplace_back(s);
+        _ids.emplace(_strings.back(), id);
+        return id;
+    }
+
+    const std::string& get(std::uint32_t id) const
+    {
+        return _strings[id];
+    }
+
+    auto size() const
+    {
+        return _strings.size();
+    }
+
+private:
+    // keys point into the strings, a deque does not move them when it grows
+    std::deque<std::string> _strings;
+    std::unordered_map<std::string_view, std::uint32_t> _ids;
+};
+
+/**
+ * Executable regions of one process sorted by their start address, they never
+ * overlap. Start addresses are kept apart from the rest so the binary search
+ * walks a dense array.
+ */
+struct region_index
+{
+    struct entry
+    {
+        std::uintptr_t start;
+        std::uintptr_t end;
+        std::uintptr_t offset;
+
+        // id in the `string_table`
+        std::uint32_t pathname;
+
+        // identity of the mapped file, inode is 0 when it is not known
+        std::uint64_t dev = 0;
+        std::uint64_t inode = 0;
+    };
+
+    /**
+     * New region replaces whatever was mapped in its range before, just like
+     * mmap(2) with MAP_FIXED does.
+     */
+    void add(const entry& e)
+    {
+        auto first = index_of_first_ending_after(e.start);
+        auto last = first;
+        while (last < _starts.size() && _starts[last] < e.end)
+            last++;
+
+        // parts of the overlapped regions which stick out on either side
+        std::vector<entry> kept;
+        if (first != last)
+        {
+            auto head = _entries[first];
+            if (head.start < e.start)
+            {
+                head.end = e.start;
+                kept.push_back(head);
+            }
+
+            auto tail = _entries[last - 1];
+            if (tail.end > e.end)
+            {
+                tail.offset += e.end - tail.start;
+                tail.start = e.end;
+                kept.push_back(tail);
+            }
+        }
+
+        _entries.erase(_entries.begin() + first, _entries.begin() + last);
+        _starts.erase(_starts.begin() + first, _starts.begin() + last);
+
+        if (!kept.empty() && kept.front().start < e.start)
+        {
+            insert_at(first, kept.front());
+            first++;
+            kept.erase(kept.begin());
+        }
+
+        insert_at(first++, e);
+
+        if (!kept.empty())
+            insert_at(first, kept.front());
+    }
+
+    /**
+     * Returns the region containing `ip` or nullptr.
+     */
+    const entry* find(std::uintptr_t ip) const
+    {
+        auto it = std::upper_bound(_starts.begin(), _starts.end(), ip);
+        if (it == _starts.begin())
+            return nullptr;
+
+        const auto& e = _entries[std::distance(_starts.begin(), it) - 1];
+        return ip < e.end ? &e : nullptr;
+    }
+
+    void clear()
+    {
+        _starts.clear();
+        _entries.clear();
+    }
+
+    auto size() const
+    {
+        return _entries.size();
+    }
+
+    const auto& entries() const
+    {
+        return _entries;
+    }
+
+private:
+    std::size_t index_of_first_ending_after(std::uintptr_t addr) const
+    {
+        auto it = std::upper_bound(_starts.begin(), _starts.end(), addr);
+        auto i = static_cast<std::size_t>(std::distance(_starts.begin(), it));
+        if (i > 0 && _entries[i - 1].end > addr)
+            i--;
+        return i;
+    }
+
+    void insert_at(std::size_t i, const entry& e)
+    {
+        _starts.insert(_starts.begin() + i, e.start);
+        _entries.insert(_entries.begin() + i, e);
+    }
+
+    std::vector<std::uintptr_t> _starts;
+    std::vector<entry> _entries;
+};
+
+} // namespace
@@ -0,0 +1,276 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "report.hpp"
+#include "binary.hpp"
+#include "folded.hpp"
+#include "output.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Text of a profile, mapped when it is a file or read when it is the
+ * standard input. Compressed profiles are decompressed and binary ones are
+ * converted to text first.
+ */
+struct profile_text
+{
+    explicit profile_text(const std::string& path)
+    {
+        if (path == "-")
+        {
+            _contents.assign(std::istreambuf_iterator<char>{std::cin}, {});
+            _text = _contents;
+        }
+        else
+        {
+            _file = std::make_unique<mapped_file>(path);
+            _text = {_file->data(), _file->size()};
+        }
+
+        if (is_gzip(_text))
+        {
+            _contents = gunzip(_text);
+            _text = _contents;
+            _file.reset();
+        }
+
+        if (is_binary_profile(_text))
+        {
+            std::string converted;
+            binary_to_text(_text, [&](std::string_view line) { converted += line; });
+            _contents = std::move(converted);
+            _text = _contents;
+            _file.reset();
+        }
+    }
+
+    std::string_view text() const
+    {
+        return _text;
+    }
+
+private:
+    std::unique_ptr<mapped_file> _file;
+    std::string _contents;
+    std::string_view _text;
+};
+
+struct report
+{
+    explicit report(const std::vector<std::string>& paths)
+        : _threads(std::max(1u, std::thread::hardware_concurrency()))
+    {
+        for (const auto& path : paths)
+            _profiles.emplace_back(std::make_unique<profile_text>(path));
+    }
+
+    /**
+     * The most frequent functions per process.
+     */
+    void top(output_stream& output)
+    {
+        auto summary = count_all();
+
+        struct top_entry
+        {
+            entry_key key;
+            entry_count count;
+        };
+
+        std::unordered_map<entry_key, top_entry, entry_key_hash> by_name;
+        for (const auto& [key, count] : summary.entries)
+        {
+            auto name = _resolver.resolve(key.pathname, key.addr, key.name);
+            auto& e = by_name[{key.pid, {}, {}, {}, name}];
+            if (count.first < e.count.first)
+                e.key = key;
+            e.count.add(count.count, count.first);
+        }
+
+        std::vector<top_entry> sorted;
+        for (const auto& [key, e] : by_name)
+            sorted.push_back({{e.key.pid, e.key.comm, e.key.pathname, e.key.addr, key.name}, e.count});
+
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+        {
+            return a.count.count != b.count.count ? a.count.count > b.count.count : a.count.first < b.count.first;
+        });
+
+        if (summary.timed)
+        {
+            std::ostringstream ss;
+            ss << "duration: " << std::setprecision(15) << (summary.last_time - summary.first_time) / 1e9 << " secs\n";
+            output.write(ss.str());
+        }
+
+        for (std::size_t i = 0; i < std::min<std::size_t>(sorted.size(), 50); i++)
+        {
+            const auto& e = sorted[i];
+            output.write_dec(e.count.count).write(' ').write(e.key.comm).write(' ').write(e.key.pathname).write(' ')
+                  .write(e.key.addr).write(' ').write(e.key.name).write('\n');
+        }
+    }
+
+    /**
+     * Every sample with its name, in the order they were written.
+     */
+    void show(output_stream& output)
+    {
+        // names are looked up once for all threads, which then only read them
+        auto summary = count_all();
+        std::unordered_map<entry_key, std::string_view, entry_key_hash> names;
+        for (const auto& [key, count] : summary.entries)
+            names.emplace(key, _resolver.resolve(key.pathname, key.addr, key.name));
+
+        for (const auto& profile : _profiles)
+        {
+            auto chunks = split_profile(profile->text(), _threads);
+            std::vector<std::string> formatted(chunks.size());
+
+            in_parallel(chunks.size(), [&](std::size_t i)
+            {
+                auto& out = formatted[i];
+                for_each_entry(chunks[i], [&](const profile_entry& e, std::size_t)
+                {
+                    auto name = names.at({e.pid, e.comm, e.pathname, e.addr, e.name});
+                    for (std::uint64_t n = 0; n < e.count; n++)
+                    {
+                        out += std::to_string(e.pid);
+                        out += ' ';
+                        out += e.comm;
+                        out += ' ';
+                        out += e.pathname;
+                        out += ' ';
+                        out += e.addr;
+                        out += ' ';
+                        out += name;
+                        out += '\n';
+                    }
+                });
+            });
+
+            for (const auto& out : formatted)
+            {
+                output.write(out);
+                output.flush();
+            }
+        }
+    }
+
+    /**
+     * Functions counted per comm in the folded format of flamegraph.pl.
+     */
+    void folded(output_stream& output)
+    {
+        auto summary = count_all();
+
+        std::unordered_map<std::string, std::uint64_t> stacks;
+        std::string stack;
+        for (const auto& [key, count] : summary.entries)
+        {
+            auto addr = key.addr;
+            if (addr.substr(0, 2) == "0x")
+                addr.remove_prefix(2);
+
+            symbol_t symbol;
+            symbol.comm = key.comm;
+            symbol.pathname = key.pathname;
+            symbol.addr = parse_hex(addr);
+            symbol.name = _resolver.resolve(key.pathname, key.addr, key.name);
+
+            stack.assign(key.comm);
+            append_folded_frame(stack, symbol);
+            stacks[stack] += count.count;
+        }
+
+        std::vector<std::pair<std::string_view, std::uint64_t>> sorted{stacks.begin(), stacks.end()};
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+        {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+        for (const auto& [s, count] : sorted)
+            output.write(s).write(' ').write_dec(count).write('\n');
+    }
+
+    /**
+     * Profiles as they are, the binary ones converted to text.
+     */
+    void text(output_stream& output)
+    {
+        for (const auto& profile : _profiles)
+        {
+            output.write(profile->text());
+            output.flush();
+        }
+    }
+
+private:
+    /**
+     * Counts entries of all profiles.
+     */
+    profile_summary count_all()
+    {
+        profile_summary ret;
+
+        // files do not overlap in positions
+        for (std::size_t i = 0; i < _profiles.size(); i++)
+            ret.merge(count_entries(_profiles[i]->text(), _threads, std::uint64_t(i) << 48));
+        return ret;
+    }
+
+    std::size_t _threads;
+    std::vector<std::unique_ptr<profile_text>> _profiles;
+    symbol_resolver _resolver;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    using poor_perf::report;
+    using poor_perf::output_stream;
+
+    const std::map<std::string, void (report::*)(output_stream&)> commands{
+        {"top", &report::top},
+        {"show", &report::show},
+        {"folded", &report::folded},
+        {"text", &report::text}};
+
+    auto command = argc > 1 ? commands.find(argv[1]) : commands.end();
+    if (command == commands.end())
+    {
+        std::cerr << "unknown or no command was given, valid ones are: top, show, folded, text\n";
+        return 1;
+    }
+
+    std::vector<std::string> paths{argv + 2, argv + argc};
+    if (paths.empty())
+        paths.push_back("-");
+
+    try
+    {
+        report r{paths};
+        output_stream output{"-"};
+        (r.*command->second)(output);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,390 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "parse.hpp"
+#include "elf.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Positions of the columns announced by a "$" line of the text profile,
+ * -1 for the ones which are not there.
+ */
+struct profile_columns
+{
+    profile_columns() = default;
+
+    explicit profile_columns(std::string_view line)
+    {
+        if (!line.empty() && line[0] == '$')
+            line.remove_prefix(1);
+        skip_spaces(line);
+
+        int i = 0;
+        std::string_view column;
+        while (next_column(line, column))
+        {
+            if (column == "time")
+                time = i;
+            else if (column == "pid")
+                pid = i;
+            else if (column == "comm")
+                comm = i;
+            else if (column == "pathname")
+                pathname = i;
+            else if (column == "addr")
+                addr = i;
+            else if (column == "name")
+                name = i;
+            else if (column == "count")
+                count = i;
+            i++;
+        }
+    }
+
+    bool valid() const
+    {
+        return pid != -1 && comm != -1 && pathname != -1 && addr != -1 && name != -1;
+    }
+
+    /**
+     * Takes the text up to the next ';'.
+     */
+    static bool next_column(std::string_view& line, std::string_view& column)
+    {
+        if (line.empty())
+            return false;
+
+        auto end = line.find(';');
+        column = line.substr(0, end);
+        line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+        return true;
+    }
+
+    int time = -1;
+    int pid = -1;
+    int comm = -1;
+    int pathname = -1;
+    int addr = -1;
+    int name = -1;
+    int count = -1;
+};
+
+/**
+ * Line of the profile with a sample, or a histogram entry with many of
+ * them. Strings refer to the text of the profile.
+ */
+struct profile_entry
+{
+    std::uint64_t time = 0;
+    std::uint32_t pid = 0;
+    std::string_view comm;
+    std::string_view pathname;
+    std::string_view addr;
+    std::string_view name;
+    std::uint64_t count = 1;
+};
+
+inline bool parse_entry(std::string_view line, const profile_columns& columns, profile_entry& entry)
+{
+    std::array<std::string_view, 16> fields;
+    std::size_t n = 0;
+    while (n < fields.size() && profile_columns::next_column(line, fields[n]))
+        n++;
+
+    auto field = [&](int i) { return i >= 0 && std::size_t(i) < n ? fields[i] : std::string_view{}; };
+    auto number = [&](int i, std::uint64_t otherwise)
+    {
+        auto s = field(i);
+        return s.empty() ? otherwise : parse_dec(s);
+    };
+
+    if (std::size_t(columns.name) >= n)
+        return false;
+
+    entry.time = number(columns.time, 0);
+    entry.pid = static_cast<std::uint32_t>(number(columns.pid, 0));
+    entry.comm = field(columns.comm);
+    entry.pathname = field(columns.pathname);
+    entry.addr = field(columns.addr);
+    entry.name = field(columns.name);
+    entry.count = number(columns.count, 1);
+    return true;
+}
+
+/**
+ * Whole lines of the profile along with the "$" line in effect where they
+ * start, so they can be parsed independently of each other.
+ */
+struct profile_chunk
+{
+    std::string_view text;
+    std::string_view format;
+};
+
+/**
+ * Runs `f(i)` for i from 0 to n on threads of their own.
+ */
+template<class F>
+void in_parallel(std::size_t n, F&& f)
+{
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < n; i++)
+        threads.emplace_back([&f, i] { f(i); });
+    if (n)
+        f(0);
+    for (auto& t : threads)
+        t.join();
+}
+
+/**
+ * Last line of the text which starts with `c`, empty when there is none.
+ */
+inline std::string_view last_line_starting_with(std::string_view text, char c)
+{
+    std::string_view ret, line;
+    while (next_line(text, line))
+        if (!line.empty() && line[0] == c)
+            ret = line;
+    return ret;
+}
+
+/**
+ * Splits the profile into `parts` chunks of about the same size, which are
+ * scanned for their "$" lines in parallel.
+ */
+inline std::vector<profile_chunk> split_profile(std::string_view text, std::size_t parts)
+{
+    parts = std::max<std::size_t>(1, parts);
+
+    std::vector<std::size_t> bounds{0};
+    for (std::size_t i = 1; i < parts; i++)
+    {
+        auto pos = std::max(bounds.back(), text.size() / parts * i);
+        auto eol = text.find('\n', pos);
+        bounds.push_back(eol == std::string_view::npos ? text.size() : eol + 1);
+    }
+    bounds.push_back(text.size());
+
+    std::vector<profile_chunk> ret(parts);
+    std::vector<std::string_view> last_format(parts);
+    in_parallel(parts, [&](std::size_t i)
+    {
+        ret[i].text = text.substr(bounds[i], bounds[i + 1] - bounds[i]);
+        last_format[i] = last_line_starting_with(ret[i].text, '$');
+    });
+
+    for (std::size_t i = 1; i < parts; i++)
+        ret[i].format = last_format[i - 1].empty() ? ret[i - 1].format : last_format[i - 1];
+    return ret;
+}
+
+/**
+ * Passes every entry of the chunk to `f`, along with the position of its
+ * line in the chunk.
+ */
+template<class F>
+void for_each_entry(const profile_chunk& chunk, F&& f)
+{
+    profile_columns columns{chunk.format};
+    std::string_view text = chunk.text, line;
+    profile_entry entry;
+
+    while (next_line(text, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        if (line[0] == '$')
+        {
+            columns = profile_columns{line};
+            continue;
+        }
+
+        if (!columns.valid())
+            throw std::runtime_error{"no format line found in profile file"};
+
+        if (parse_entry(line, columns, entry))
+            f(entry, std::size_t(line.data() - chunk.text.data()));
+    }
+}
+
+/**
+ * What tells the entries apart when they are counted.
+ */
+struct entry_key
+{
+    std::uint32_t pid;
+    std::string_view comm;
+    std::string_view pathname;
+    std::string_view addr;
+    std::string_view name;
+
+    bool operator==(const entry_key& other) const
+    {
+        return pid == other.pid && addr == other.addr && name == other.name && pathname == other.pathname &&
+            comm == other.comm;
+    }
+};
+
+struct entry_key_hash
+{
+    std::size_t operator()(const entry_key& k) const
+    {
+        std::hash<std::string_view> h;
+        std::size_t seed = k.pid;
+        for (auto s : {k.comm, k.pathname, k.addr, k.name})
+            seed ^= h(s) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        return seed;
+    }
+};
+
+/**
+ * Number of samples of an entry and the position of the first one, used
+ * to keep the order in which entries appear.
+ */
+struct entry_count
+{
+    std::uint64_t count = 0;
+    std::uint64_t first = ~std::uint64_t(0);
+
+    void add(std::uint64_t n, std::uint64_t position)
+    {
+        count += n;
+        first = std::min(first, position);
+    }
+};
+
+using entry_counts = std::unordered_map<entry_key, entry_count, entry_key_hash>;
+
+/**
+ * Entries of one or more profiles counted together.
+ */
+struct profile_summary
+{
+    entry_counts entries;
+
+    // of the first and the last sample, when the profile has times
+    bool timed = false;
+    std::uint64_t first_time = 0;
+    std::uint64_t last_time = 0;
+
+    /**
+     * Adds a summary of what comes after this one.
+     */
+    void merge(profile_summary&& later)
+    {
+        if (entries.empty())
+            entries = std::move(later.entries);
+        else
+            for (const auto& [key, count] : later.entries)
+            {
+                auto& merged = entries[key];
+                merged.count += count.count;
+                merged.first = std::min(merged.first, count.first);
+            }
+
+        if (later.timed)
+        {
+            if (!timed)
+                first_time = later.first_time;
+            last_time = later.last_time;
+            timed = true;
+        }
+    }
+};
+
+/**
+ * Entries of the profile counted by `threads` threads, each into a map of its
+ * own which are merged at the end. `base` is added to positions of entries.
+ */
+inline profile_summary count_entries(std::string_view text, std::size_t threads, std::uint64_t base = 0)
+{
+    auto chunks = split_profile(text, threads);
+
+    std::vector<profile_summary> partial(chunks.size());
+    in_parallel(chunks.size(), [&](std::size_t i)
+    {
+        auto& summary = partial[i];
+        const auto offset = base + (chunks[i].text.data() - text.data());
+        for_each_entry(chunks[i], [&](const profile_entry& e, std::size_t position)
+        {
+            summary.entries[{e.pid, e.comm, e.pathname, e.addr, e.name}].add(e.count, offset + position);
+
+            if (e.time)
+            {
+                if (!summary.timed)
+                    summary.first_time = e.time;
+                summary.last_time = e.time;
+                summary.timed = true;
+            }
+        });
+    });
+
+    profile_summary ret;
+    for (auto& summary : partial)
+        ret.merge(std::move(summary));
+    return ret;
+}
+
+/**
+ * Names of user space functions the profile did not have, read from the
+ * binaries on this machine, like addr2line would do.
+ */
+struct symbol_resolver
+{
+    /**
+     * `name` when it is known, otherwise the function at `addr` in the file
+     * at `pathname`, or "-" if there is none.
+     */
+    std::string_view resolve(std::string_view pathname, std::string_view addr, std::string_view name)
+    {
+        if (name != "-" || pathname.empty() || pathname[0] != '/')
+            return name;
+
+        auto it = _files.find(pathname);
+        if (it == _files.end())
+        {
+            std::unique_ptr<elf_symbols> symbols;
+            try
+            {
+                symbols = std::make_unique<elf_symbols>(std::string{pathname});
+            }
+            catch (const std::exception&)
+            {
+            }
+            it = _files.emplace(pathname, std::move(symbols)).first;
+        }
+
+        if (!it->second)
+            return name;
+
+        if (addr.substr(0, 2) == "0x")
+            addr.remove_prefix(2);
+        auto found = it->second->find(parse_hex(addr));
+        return found.empty() ? name : found;
+    }
+
+private:
+    std::unordered_map<std::string_view, std::unique_ptr<elf_symbols>> _files;
+};
+
+} // namespace
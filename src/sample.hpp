@@ -0,0 +1,209 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <linux/perf_event.h>
+
+namespace poor_perf
+{
+
+/**
+ * Fields of PERF_RECORD_SAMPLE, each one is present in `sample` only if its
+ * bit is set in the sample type. Using a field which was not asked for does
+ * not compile.
+ */
+namespace sample_fields
+{
+
+// not in the headers of older kernels
+constexpr std::uint64_t sample_cgroup = 1u << 21;
+
+template<bool> struct ip {};
+template<> struct ip<true> { std::uint64_t ip; };
+
+template<bool> struct tid {};
+template<> struct tid<true> { std::uint32_t pid, tid; };
+
+template<bool> struct time {};
+template<> struct time<true> { std::uint64_t time; };
+
+template<bool> struct addr {};
+template<> struct addr<true> { std::uint64_t addr; };
+
+template<bool> struct id {};
+template<> struct id<true> { std::uint64_t id; };
+
+template<bool> struct stream_id {};
+template<> struct stream_id<true> { std::uint64_t stream_id; };
+
+template<bool> struct cpu {};
+template<> struct cpu<true> { std::uint32_t cpu, res; };
+
+template<bool> struct period {};
+template<> struct period<true> { std::uint64_t period; };
+
+/**
+ * Points into the record, it is valid only as long as the record is.
+ */
+template<bool> struct callchain {};
+template<> struct callchain<true> { std::uint64_t nr; const std::uint64_t* ips; };
+
+template<bool> struct weight {};
+template<> struct weight<true> { std::uint64_t weight; };
+
+template<bool> struct data_src {};
+template<> struct data_src<true> { std::uint64_t data_src; };
+
+template<bool> struct transaction {};
+template<> struct transaction<true> { std::uint64_t transaction; };
+
+template<bool> struct phys_addr {};
+template<> struct phys_addr<true> { std::uint64_t phys_addr; };
+
+template<bool> struct cgroup {};
+template<> struct cgroup<true> { std::uint64_t cgroup; };
+
+constexpr std::uint64_t supported = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP | PERF_SAMPLE_TID |
+    PERF_SAMPLE_TIME | PERF_SAMPLE_ADDR | PERF_SAMPLE_ID | PERF_SAMPLE_STREAM_ID | PERF_SAMPLE_CPU |
+    PERF_SAMPLE_PERIOD | PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC |
+    PERF_SAMPLE_TRANSACTION | PERF_SAMPLE_PHYS_ADDR | sample_cgroup;
+
+constexpr bool has(std::uint64_t type, std::uint64_t bit)
+{
+    return (type & bit) != 0;
+}
+
+} // namespace sample_fields
+
+/**
+ * Decoded PERF_RECORD_SAMPLE of the given sample type, see perf_event_open(2).
+ */
+template<std::uint64_t Type>
+struct sample :
+    sample_fields::ip<sample_fields::has(Type, PERF_SAMPLE_IP)>,
+    sample_fields::tid<sample_fields::has(Type, PERF_SAMPLE_TID)>,
+    sample_fields::time<sample_fields::has(Type, PERF_SAMPLE_TIME)>,
+    sample_fields::addr<sample_fields::has(Type, PERF_SAMPLE_ADDR)>,
+    sample_fields::id<sample_fields::has(Type, PERF_SAMPLE_ID | PERF_SAMPLE_IDENTIFIER)>,
+    sample_fields::stream_id<sample_fields::has(Type, PERF_SAMPLE_STREAM_ID)>,
+    sample_fields::cpu<sample_fields::has(Type, PERF_SAMPLE_CPU)>,
+    sample_fields::period<sample_fields::has(Type, PERF_SAMPLE_PERIOD)>,
+    sample_fields::callchain<sample_fields::has(Type, PERF_SAMPLE_CALLCHAIN)>,
+    sample_fields::weight<sample_fields::has(Type, PERF_SAMPLE_WEIGHT)>,
+    sample_fields::data_src<sample_fields::has(Type, PERF_SAMPLE_DATA_SRC)>,
+    sample_fields::transaction<sample_fields::has(Type, PERF_SAMPLE_TRANSACTION)>,
+    sample_fields::phys_addr<sample_fields::has(Type, PERF_SAMPLE_PHYS_ADDR)>,
+    sample_fields::cgroup<sample_fields::has(Type, sample_fields::sample_cgroup)>
+{
+    static_assert((Type & ~sample_fields::supported) == 0, "sample type has fields which cannot be decoded");
+
+    constexpr static std::uint64_t type = Type;
+
+    // no variable length fields, every record has the same size
+    constexpr static bool fixed_size = !sample_fields::has(Type, PERF_SAMPLE_CALLCHAIN);
+};
+
+namespace sample_fields
+{
+
+template<class T>
+inline void take(const char*& p, T& value)
+{
+    ::memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+}
+
+/**
+ * Size of the body when all fields have a fixed size.
+ */
+constexpr std::size_t fixed_body_size(std::uint64_t type)
+{
+    std::size_t ret = 0;
+    for (auto bit : {PERF_SAMPLE_IDENTIFIER, PERF_SAMPLE_IP, PERF_SAMPLE_TID, PERF_SAMPLE_TIME,
+                     PERF_SAMPLE_ADDR, PERF_SAMPLE_ID, PERF_SAMPLE_STREAM_ID, PERF_SAMPLE_CPU,
+                     PERF_SAMPLE_PERIOD, PERF_SAMPLE_WEIGHT, PERF_SAMPLE_DATA_SRC,
+                     PERF_SAMPLE_TRANSACTION, PERF_SAMPLE_PHYS_ADDR})
+    {
+        if (type & bit)
+            ret += 8;
+    }
+    if (type & sample_cgroup)
+        ret += 8;
+    return ret;
+}
+
+} // namespace sample_fields
+
+/**
+ * Decodes the body of PERF_RECORD_SAMPLE, fields come in the order given by
+ * perf_event_open(2). Everything is resolved at compile time so a sample of
+ * fixed size is read with a handful of loads.
+ */
+template<std::uint64_t Type>
+inline sample<Type> decode_sample(const char* p)
+{
+    using namespace sample_fields;
+
+    sample<Type> ret;
+    std::uint64_t skipped;
+
+    if constexpr (has(Type, PERF_SAMPLE_IDENTIFIER))
+        take(p, ret.id);
+    if constexpr (has(Type, PERF_SAMPLE_IP))
+        take(p, ret.ip);
+    if constexpr (has(Type, PERF_SAMPLE_TID))
+    {
+        take(p, ret.pid);
+        take(p, ret.tid);
+    }
+    if constexpr (has(Type, PERF_SAMPLE_TIME))
+        take(p, ret.time);
+    if constexpr (has(Type, PERF_SAMPLE_ADDR))
+        take(p, ret.addr);
+    if constexpr (has(Type, PERF_SAMPLE_ID))
+    {
+        // the same as PERF_SAMPLE_IDENTIFIER when both are set
+        if constexpr (has(Type, PERF_SAMPLE_IDENTIFIER))
+            take(p, skipped);
+        else
+            take(p, ret.id);
+    }
+    if constexpr (has(Type, PERF_SAMPLE_STREAM_ID))
+        take(p, ret.stream_id);
+    if constexpr (has(Type, PERF_SAMPLE_CPU))
+    {
+        take(p, ret.cpu);
+        take(p, ret.res);
+    }
+    if constexpr (has(Type, PERF_SAMPLE_PERIOD))
+        take(p, ret.period);
+    if constexpr (has(Type, PERF_SAMPLE_CALLCHAIN))
+    {
+        take(p, ret.nr);
+        ret.ips = reinterpret_cast<const std::uint64_t*>(p);
+        p += ret.nr * sizeof(std::uint64_t);
+    }
+    if constexpr (has(Type, PERF_SAMPLE_WEIGHT))
+        take(p, ret.weight);
+    if constexpr (has(Type, PERF_SAMPLE_DATA_SRC))
+        take(p, ret.data_src);
+    if constexpr (has(Type, PERF_SAMPLE_TRANSACTION))
+        take(p, ret.transaction);
+    if constexpr (has(Type, PERF_SAMPLE_PHYS_ADDR))
+        take(p, ret.phys_addr);
+    if constexpr (has(Type, sample_cgroup))
+        take(p, ret.cgroup);
+
+    (void)skipped;
+    (void)p;
+    return ret;
+}
+
+} // namespace
@@ -0,0 +1,34 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <string_view>
+
+#include "output.hpp"
+#include "perf.hpp"
+#include "proc.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Columns of the samples format, a line per sample; `event` is the one the
+ * sample was taken on.
+ */
+constexpr std::string_view samples_format_line{"$ time;cpu;pid;comm;pathname;addr;name;event\n"};
+
+inline void write_sample_line(output_stream& output, const sample_t& sample, const symbol_t& s, std::string_view event)
+{
+    output.write_dec(sample.time).write(';').write_dec(sample.cpu).write(';').write_dec(sample.pid).write(';')
+          .write(s.comm).write(';')
+          .write(s.pathname)
+          .write(";0x").write_hex(s.addr).write(';')
+          .write(s.name).write(';')
+          .write(event).write('\n');
+}
+
+} // namespace
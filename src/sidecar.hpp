@@ -0,0 +1,253 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "proc.hpp"
+#include "parse.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Binary file written next to the profile which describes the binaries hit
+ * by its samples, so it can be symbolized offline against the very same
+ * builds, even when they were upgraded on the target since.
+ *
+ * It starts with `sidecar_magic` and continues with records, each one being
+ * a u32 type and a u32 size of the body which follows, all little endian:
+ *
+ *  - profile: u64 time when it started, on the clock of the samples; records
+ *    up to the next profile one belong to it
+ *  - dso: u32 id, u64 device, u64 inode, u16 size and bytes of the GNU
+ *    build-id, u16 size and bytes of the path; device and inode are those
+ *    of the file which was mapped, the build-id is left empty when that file
+ *    cannot be read anymore
+ *  - map: u32 pid, u32 dso id, u64 start, u64 end, u64 file offset
+ *
+ * Profiles are appended just like the text ones are.
+ */
+constexpr std::string_view sidecar_magic{"PPMAPS\x00\x01", 8};
+
+enum class sidecar_record : std::uint32_t
+{
+    profile = 1,
+    dso = 2,
+    map = 3
+};
+
+/**
+ * Contents of a sidecar as they are read back.
+ */
+struct sidecar_contents
+{
+    struct dso
+    {
+        std::uint64_t dev;
+        std::uint64_t inode;
+        std::string build_id;
+        std::string path;
+    };
+
+    struct map
+    {
+        std::uint32_t pid;
+        std::uint32_t dso;
+        std::uint64_t start;
+        std::uint64_t end;
+        std::uint64_t offset;
+    };
+
+    struct profile
+    {
+        std::uint64_t time;
+        std::unordered_map<std::uint32_t, dso> dsos;
+        std::vector<map> maps;
+    };
+
+    std::vector<profile> profiles;
+};
+
+namespace detail
+{
+
+template<class T>
+void append(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void append_bytes(std::string& out, std::string_view bytes)
+{
+    bytes = bytes.substr(0, 0xffff);
+    append(out, static_cast<std::uint16_t>(bytes.size()));
+    out.append(bytes);
+}
+
+inline void append_record(std::string& out, sidecar_record type, const std::string& body)
+{
+    append(out, static_cast<std::uint32_t>(type));
+    append(out, static_cast<std::uint32_t>(body.size()));
+    out += body;
+}
+
+template<class T>
+bool take(std::string_view& in, T& value)
+{
+    if (in.size() < sizeof(value))
+        return false;
+    ::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+}
+
+inline bool take_bytes(std::string_view& in, std::string& bytes)
+{
+    std::uint16_t size;
+    if (!take(in, size) || in.size() < size)
+        return false;
+    bytes.assign(in.data(), size);
+    in.remove_prefix(size);
+    return true;
+}
+
+} // namespace detail
+
+/**
+ * Appends the regions hit by a profile which started at `time` to the
+ * sidecar at `path`, the magic is written when the file is empty.
+ */
+inline void write_sidecar(const std::string& path, std::uint64_t time, const region_hits& hits,
+    const running_processes_snapshot& processes)
+{
+    using namespace detail;
+
+    std::string out, body;
+
+    append(body, time);
+    append_record(out, sidecar_record::profile, body);
+
+    // a path may refer to several files when a binary was replaced while it was mapped
+    std::map<std::tuple<std::uint32_t, std::uint64_t, std::uint64_t>, std::uint32_t> dsos;
+    for (const auto& [key, region] : hits)
+    {
+        auto [it, inserted] = dsos.try_emplace({region.pathname, region.dev, region.inode},
+            static_cast<std::uint32_t>(dsos.size()));
+        if (inserted)
+        {
+            const auto* elf = processes.file_symbols(key.first, region);
+
+            body.clear();
+            append(body, it->second);
+            append(body, region.dev);
+            append(body, region.inode);
+            append_bytes(body, elf ? elf->build_id() : std::string{});
+            append_bytes(body, processes.pathname(region.pathname));
+            append_record(out, sidecar_record::dso, body);
+        }
+
+        body.clear();
+        append(body, key.first);
+        append(body, it->second);
+        append(body, std::uint64_t(region.start));
+        append(body, std::uint64_t(region.end));
+        append(body, std::uint64_t(region.offset));
+        append_record(out, sidecar_record::map, body);
+    }
+
+    auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::runtime_error{"could not open '" + path + "' for writing"};
+
+    if (::lseek(fd, 0, SEEK_END) == 0)
+        out.insert(0, sidecar_magic);
+
+    std::size_t written = 0;
+    while (written < out.size())
+    {
+        auto n = ::write(fd, out.data() + written, out.size() - written);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    ::close(fd);
+}
+
+/**
+ * Reads what was written by `write_sidecar`, a truncated record at the end
+ * is ignored.
+ */
+inline sidecar_contents read_sidecar(const std::string& path)
+{
+    using namespace detail;
+
+    const auto contents = read_file(path, 1 << 16);
+    std::string_view in{contents};
+
+    if (in.substr(0, sidecar_magic.size()) != sidecar_magic)
+        throw std::runtime_error{"'" + path + "' is not a sidecar of a profile"};
+    in.remove_prefix(sidecar_magic.size());
+
+    sidecar_contents ret;
+    std::uint32_t type, size;
+    while (take(in, type) && take(in, size) && in.size() >= size)
+    {
+        auto body = in.substr(0, size);
+        in.remove_prefix(size);
+
+        switch (static_cast<sidecar_record>(type))
+        {
+            case sidecar_record::profile:
+            {
+                ret.profiles.emplace_back();
+                take(body, ret.profiles.back().time);
+                break;
+            }
+            case sidecar_record::dso:
+            {
+                std::uint32_t id;
+                sidecar_contents::dso dso;
+                if (ret.profiles.empty() || !take(body, id) || !take(body, dso.dev) || !take(body, dso.inode) ||
+                    !take_bytes(body, dso.build_id) || !take_bytes(body, dso.path))
+                    break;
+                ret.profiles.back().dsos[id] = std::move(dso);
+                break;
+            }
+            case sidecar_record::map:
+            {
+                sidecar_contents::map map;
+                if (ret.profiles.empty() || !take(body, map.pid) || !take(body, map.dso) || !take(body, map.start) ||
+                    !take(body, map.end) || !take(body, map.offset))
+                    break;
+                ret.profiles.back().maps.push_back(map);
+                break;
+            }
+            default:
+                // unknown records are skipped, they may come from a newer version
+                break;
+        }
+    }
+
+    return ret;
+}
+
+} // namespace
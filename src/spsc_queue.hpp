@@ -0,0 +1,82 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace poor_perf
+{
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ *
+ * Elements are not moved in and out, they stay in their slots and are
+ * filled and read in place. Whatever they allocate, like the capacity of a
+ * vector, is reused the next time around so a steady state costs no
+ * allocations on either side.
+ */
+template<class T>
+struct spsc_queue
+{
+    explicit spsc_queue(std::size_t capacity) : _slots(capacity + 1)
+    {
+    }
+
+    /**
+     * Free slot to be filled by the producer or nullptr when the queue is full.
+     */
+    T* back()
+    {
+        const auto tail = _tail.load(std::memory_order_relaxed);
+        if (next(tail) == _head.load(std::memory_order_acquire))
+            return nullptr;
+        return &_slots[tail];
+    }
+
+    /**
+     * Publishes the slot returned by `back`.
+     */
+    void push()
+    {
+        _tail.store(next(_tail.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    /**
+     * Oldest published slot or nullptr when the queue is empty.
+     */
+    T* front()
+    {
+        const auto head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &_slots[head];
+    }
+
+    /**
+     * Gives the slot returned by `front` back to the producer.
+     */
+    void pop()
+    {
+        _head.store(next(_head.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+private:
+    std::size_t next(std::size_t i) const
+    {
+        return i + 1 == _slots.size() ? 0 : i + 1;
+    }
+
+    std::vector<T> _slots;
+
+    // written by the consumer and the producer respectively, kept on separate cache lines
+    alignas(64) std::atomic<std::size_t> _head{0};
+    alignas(64) std::atomic<std::size_t> _tail{0};
+};
+
+} // namespace
@@ -0,0 +1,176 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parse.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Where a single profile is written.
+ */
+struct profile_target
+{
+    std::string path;
+
+    // of the maps of the binaries, empty for none
+    std::string sidecar;
+
+    // how much to reserve on the disk up front
+    std::uint64_t preallocate = 0;
+};
+
+/**
+ * Files the profiles are written to.
+ *
+ * Without rotation, every profile is appended to the output. With it, every
+ * one gets a file of its own, the output name with a sequence number added,
+ * along with its sidecar, and once one is written, the oldest are removed
+ * until at most `keep` profiles taking at most `max_bytes` are left; zero
+ * means no limit. The newest one is never removed.
+ */
+struct profile_storage
+{
+    profile_storage(std::string output, std::size_t keep, std::uint64_t max_bytes, bool compress)
+        : _output(std::move(output)), _keep(keep), _max_bytes(max_bytes), _compress(compress)
+    {
+        if (!rotating())
+            return;
+
+        auto stored = scan();
+        if (!stored.empty())
+            _last = stored.rbegin()->first;
+    }
+
+    bool rotating() const
+    {
+        return _keep || _max_bytes;
+    }
+
+    /**
+     * Target of the next profile, expected to be about as large as the last
+     * one when they are rotated.
+     */
+    profile_target next()
+    {
+        if (!rotating())
+            return {_output, _output == "-" ? "" : _output + ".maps"};
+
+        auto stored = scan();
+        const auto last = stored.find(_last);
+
+        profile_target ret;
+        const auto base = _output + "." + std::to_string(++_last);
+        ret.path = _compress ? base + ".gz" : base;
+        ret.sidecar = base + ".maps";
+        if (last != stored.end())
+            ret.preallocate = _max_bytes ? std::min(last->second.profile_bytes, _max_bytes) : last->second.profile_bytes;
+        return ret;
+    }
+
+    /**
+     * Removes the oldest profiles over the limits, returns how many.
+     */
+    std::size_t prune()
+    {
+        if (!rotating())
+            return 0;
+
+        auto stored = scan();
+        std::uint64_t total = 0;
+        for (const auto& [seq, profile] : stored)
+            total += profile.bytes;
+
+        std::size_t removed = 0;
+        while (stored.size() > 1 && ((_keep && stored.size() > _keep) || (_max_bytes && total > _max_bytes)))
+        {
+            auto oldest = stored.begin();
+            for (const auto& path : oldest->second.paths)
+                ::unlink(path.c_str());
+
+            total -= oldest->second.bytes;
+            stored.erase(oldest);
+            removed++;
+        }
+        return removed;
+    }
+
+private:
+    struct stored_profile
+    {
+        std::vector<std::string> paths;
+
+        // of all files and of the profile alone
+        std::uint64_t bytes = 0;
+        std::uint64_t profile_bytes = 0;
+    };
+
+    /**
+     * Profiles found next to the output by their sequence numbers, the
+     * files of each one are "<output>.<seq>", its ".gz" and ".maps".
+     */
+    std::map<std::uint64_t, stored_profile> scan() const
+    {
+        const auto slash = _output.rfind('/');
+        const auto dir = slash == std::string::npos ? std::string{"."} : _output.substr(0, slash + 1);
+        const auto prefix = (slash == std::string::npos ? _output : _output.substr(slash + 1)) + ".";
+
+        std::map<std::uint64_t, stored_profile> ret;
+        DIR* d = ::opendir(dir.c_str());
+        if (!d)
+            return ret;
+
+        while (auto entry = ::readdir(d))
+        {
+            std::string_view name{entry->d_name};
+            if (name.substr(0, prefix.size()) != prefix)
+                continue;
+
+            auto rest = name.substr(prefix.size());
+            const auto digits = rest.size();
+            auto seq = parse_dec(rest);
+            if (rest.size() == digits || (!rest.empty() && rest != ".gz" && rest != ".maps"))
+                continue;
+
+            const auto path = (slash == std::string::npos ? std::string{} : dir) + std::string{name};
+            struct stat st;
+            if (::stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+                continue;
+
+            auto& profile = ret[seq];
+            profile.paths.push_back(path);
+            profile.bytes += st.st_size;
+            if (rest != ".maps")
+                profile.profile_bytes += st.st_size;
+        }
+
+        ::closedir(d);
+        return ret;
+    }
+
+    std::string _output;
+    std::size_t _keep;
+    std::uint64_t _max_bytes;
+    bool _compress;
+
+    // sequence number of the newest profile
+    std::uint64_t _last = 0;
+};
+
+} // namespace
@@ -0,0 +1,316 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+
+#include "perf.hpp"
+#include "proc.hpp"
+#include "cpu_list.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * One change to the table of running processes, decoded from a perf record.
+ */
+struct process_event
+{
+    enum class type_t
+    {
+        mmap,
+        comm,
+        exec,
+        fork,
+        exit
+    };
+
+    type_t type;
+    std::uint64_t time;
+    std::uint32_t pid;
+    std::uint32_t ppid;
+
+    // only for mmap
+    std::uintptr_t start, end, offset;
+    std::uint64_t dev, inode;
+    std::string perms;
+
+    // pathname for mmap, process name for comm and exec
+    std::string name;
+};
+
+/**
+ * With `tracking_attr` every record ends with the time from sample_id.
+ */
+inline std::uint64_t record_time(const perf_event_header& header, const char* body)
+{
+    std::uint64_t time;
+    ::memcpy(&time, body + header.size - sizeof(header) - sizeof(time), sizeof(time));
+    return time;
+}
+
+/**
+ * Decodes the record, returns false if it is not about processes.
+ */
+inline bool decode_process_event(const perf_event_header& header, const char* body, process_event& event)
+{
+    struct mmap2_record
+    {
+        std::uint32_t pid, tid;
+        std::uint64_t addr, len, pgoff;
+        std::uint32_t maj, min;
+        std::uint64_t ino, ino_generation;
+        std::uint32_t prot, flags;
+    };
+
+    struct comm_record
+    {
+        std::uint32_t pid, tid;
+    };
+
+    struct task_record
+    {
+        std::uint32_t pid, ppid;
+        std::uint32_t tid, ptid;
+        std::uint64_t time;
+    };
+
+    switch (header.type)
+    {
+        case PERF_RECORD_MMAP2:
+        {
+            mmap2_record r;
+            ::memcpy(&r, body, sizeof(r));
+
+            event.type = process_event::type_t::mmap;
+            event.time = record_time(header, body);
+            event.pid = r.pid;
+            event.start = r.addr;
+            event.end = r.addr + r.len;
+            event.offset = r.pgoff;
+            event.dev = makedev(r.maj, r.min);
+            event.inode = r.ino;
+            event.perms = {r.prot & PROT_READ ? 'r' : '-',
+                           r.prot & PROT_WRITE ? 'w' : '-',
+                           r.prot & PROT_EXEC ? 'x' : '-',
+                           r.flags & MAP_SHARED ? 's' : 'p'};
+            event.name = body + sizeof(r);
+            return true;
+        }
+        case PERF_RECORD_COMM:
+        {
+            comm_record r;
+            ::memcpy(&r, body, sizeof(r));
+
+            // renamed threads are not interesting, /proc/$PID/comm is the name of the main one
+            if (r.pid != r.tid)
+                return false;
+
+            event.type = header.misc & PERF_RECORD_MISC_COMM_EXEC ? process_event::type_t::exec : process_event::type_t::comm;
+            event.time = record_time(header, body);
+            event.pid = r.pid;
+            event.name = body + sizeof(r);
+            return true;
+        }
+        case PERF_RECORD_FORK:
+        case PERF_RECORD_EXIT:
+        {
+            task_record r;
+            ::memcpy(&r, body, sizeof(r));
+
+            // threads share the maps with their process
+            if (r.pid != r.tid)
+                return false;
+
+            event.type = header.type == PERF_RECORD_FORK ? process_event::type_t::fork : process_event::type_t::exit;
+            event.time = r.time;
+            event.pid = r.pid;
+            event.ppid = r.ppid;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+inline void apply(running_processes_snapshot& processes, process_event& event)
+{
+    switch (event.type)
+    {
+        case process_event::type_t::mmap:
+            processes.on_mmap(event.pid, region_t{event.start, event.end, std::move(event.perms), event.offset,
+                std::move(event.name), event.dev, event.inode});
+            break;
+        case process_event::type_t::comm:
+            processes.on_comm(event.pid, std::move(event.name), false);
+            break;
+        case process_event::type_t::exec:
+            processes.on_comm(event.pid, std::move(event.name), true);
+            break;
+        case process_event::type_t::fork:
+            processes.on_fork(event.pid, event.ppid);
+            break;
+        case process_event::type_t::exit:
+            processes.on_exit(event.pid);
+            break;
+    }
+}
+
+/**
+ * Follows processes being started, exec'd, mapping code and exiting on all
+ * online cpus so `running_processes_snapshot` does not go stale.
+ *
+ * It should be created before the snapshot is taken so nothing falls between
+ * the two, records about what is already in the snapshot are harmless.
+ * Records are kept until the samples they precede are symbolized, see
+ * `apply_until`.
+ */
+struct process_tracker
+{
+    /**
+     * Without rings of its own, it is fed by `read(ring_reader&)`.
+     */
+    process_tracker() = default;
+
+    explicit process_tracker(std::size_t data_pages)
+    {
+        for (auto cpu : online_cpus())
+        {
+            _sessions.push_back(std::make_unique<perf_session>(tracking_attr(data_pages), cpu, data_pages));
+            _cpus.push_back(cpu);
+        }
+    }
+
+    /**
+     * Raw records read from the ring of every cpu are passed to `f` along
+     * with the cpu.
+     */
+    void capture_to(std::function<void(std::uint32_t, std::string_view)> f)
+    {
+        for (std::size_t i = 0; i < _sessions.size(); i++)
+        {
+            _sessions[i]->capture_to([f, cpu = static_cast<std::uint32_t>(_cpus[i])](std::string_view records)
+            {
+                f(cpu, records);
+            });
+        }
+    }
+
+    std::vector<int> fds() const
+    {
+        std::vector<int> ret;
+        for (const auto& session : _sessions)
+            ret.push_back(session->fd());
+        return ret;
+    }
+
+    /**
+     * Drains the rings of all cpus.
+     */
+    void read()
+    {
+        const auto old_size = _pending.size();
+
+        for (auto& session : _sessions)
+            session->read_some([](const auto&) {}, [&](const perf_event_header& header, const char* body) { add(header, body); });
+
+        sort_since(old_size);
+    }
+
+    /**
+     * Reads records which come from elsewhere, e.g. from a capture.
+     */
+    void read(ring_reader& ring)
+    {
+        const auto old_size = _pending.size();
+
+        read_records(ring, _replayed_stats, [](const auto&) {}, [&](const perf_event_header& header, const char* body)
+        {
+            add(header, body);
+        });
+
+        sort_since(old_size);
+    }
+
+    /**
+     * Records lost on all cpus since the last call, symbolization may be off
+     * when this is not zero.
+     */
+    ring_stats take_stats()
+    {
+        ring_stats ret = _replayed_stats;
+        _replayed_stats = {};
+        for (auto& session : _sessions)
+            ret += session->take_stats();
+        return ret;
+    }
+
+    /**
+     * Applies what has happened before `time`.
+     */
+    void apply_until(std::uint64_t time, running_processes_snapshot& processes)
+    {
+        while (!_pending.empty() && _pending.front().time <= time)
+        {
+            apply(processes, _pending.front());
+            _pending.pop_front();
+        }
+    }
+
+    /**
+     * Applies what has happened before `time` and forgets processes which
+     * exited by then, there must be no older samples left to symbolize.
+     */
+    void apply_all_until(std::uint64_t time, running_processes_snapshot& processes)
+    {
+        apply_until(time, processes);
+        processes.remove_exited();
+    }
+
+    /**
+     * Applies everything, there must be no samples left to symbolize.
+     */
+    void apply_all(running_processes_snapshot& processes)
+    {
+        apply_all_until(std::numeric_limits<std::uint64_t>::max(), processes);
+    }
+
+private:
+    void add(const perf_event_header& header, const char* body)
+    {
+        process_event event;
+        if (decode_process_event(header, body, event))
+            _pending.push_back(std::move(event));
+    }
+
+    void sort_since(std::size_t old_size)
+    {
+        if (_pending.size() != old_size)
+        {
+            std::stable_sort(_pending.begin(), _pending.end(), [](const auto& a, const auto& b)
+            {
+                return a.time < b.time;
+            });
+        }
+    }
+
+    std::vector<std::unique_ptr<perf_session>> _sessions;
+    std::vector<std::size_t> _cpus;
+    std::deque<process_event> _pending;
+    ring_stats _replayed_stats;
+};
+
+} // namespace
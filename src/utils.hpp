@@ -6,24 +6,48 @@
  */
 #pragma once
 
+#include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <ostream>
 #include <iomanip>
+#include <sstream>
 #include <pthread.h>
 #include <thread>
+#include <unistd.h>
+
+#include "cpu_list.hpp"
 
 struct current_time
 {
 };
 
-std::ostream& operator<<(std::ostream& os, current_time)
+inline std::ostream& operator<<(std::ostream& os, current_time)
 {
     using clock = std::chrono::system_clock;
     std::time_t now_c = clock::to_time_t(clock::now());
     return os << std::put_time(std::localtime(&now_c), "%F %T");
 }
 
-void set_this_thread_into_realtime()
+/**
+ * Writes the whole buffer unless the file fails, in which case the rest is
+ * dropped as there is nobody to complain to.
+ */
+inline void write_all(int fd, const char* data, std::size_t size)
+{
+    std::size_t written = 0;
+    while (written < size)
+    {
+        auto n = ::write(fd, data + written, size - written);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += n;
+    }
+}
+
+inline void set_this_thread_into_realtime()
 {
     ::sched_param param{};
     param.sched_priority = sched_get_priority_max(SCHED_FIFO);
@@ -32,67 +56,41 @@ void set_this_thread_into_realtime()
         throw std::runtime_error("failed to set thread scheduling");
 }
 
-void set_this_thread_name(const char* name)
+/**
+ * Back to the default policy, for helpers of a realtime thread which
+ * inherited its scheduling.
+ */
+inline void set_this_thread_into_normal()
+{
+    ::sched_param param{};
+    int ret = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    if (ret)
+        throw std::runtime_error("failed to set thread scheduling");
+}
+
+inline void set_this_thread_name(const char* name)
 {
     int ret = pthread_setname_np(pthread_self(), name);
     if (ret)
         throw std::runtime_error("failed to set thread name");
 }
 
-void set_this_thread_affinity(std::size_t cpu)
+inline void set_this_thread_affinity(const poor_perf::cpu_list& cpus)
 {
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
-    CPU_SET(cpu, &cpuset);
+    for (auto cpu : cpus)
+        CPU_SET(cpu, &cpuset);
     int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
     if (ret)
     {
         std::stringstream ss;
-        ss << "failed to set thread affinity to cpu " << cpu;
+        ss << "failed to set thread affinity to cpus " << cpus;
         throw std::runtime_error(ss.str());
     }
 }
 
-struct watchdog
+inline void set_this_thread_affinity(std::size_t cpu)
 {
-    watchdog(std::size_t cpu)
-    {
-        auto normal_thread = [this, cpu]
-        {
-            set_this_thread_name("poor-watchdog");
-            set_this_thread_affinity(cpu);
-
-            while (_running.load(std::memory_order_relaxed))
-            {
-                _flag.store(true, std::memory_order_relaxed);
-                std::this_thread::sleep_for(_interval);
-            }
-        };
-
-        _thread = std::thread{normal_thread};
-    }
-
-    ~watchdog()
-    {
-        std::cerr << "waiting for watchdog thread to stop\n";
-        _running.store(false, std::memory_order_relaxed);
-        _thread.join();
-    }
-
-    auto interval() const
-    {
-        return _interval;
-    }
-
-    bool ping()
-    {
-        // false will mean that normal thread was unable to do the work
-        return _flag.exchange(false, std::memory_order_relaxed);
-    }
-
-private:
-    std::atomic<bool> _running{true};
-    std::atomic<bool> _flag{true};
-    std::thread _thread;
-    std::chrono::seconds _interval{1};
-};
+    set_this_thread_affinity(poor_perf::cpu_list{{cpu}});
+}
@@ -0,0 +1,280 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace poor_perf
+{
+
+/**
+ * Histogram of latencies in nanoseconds in the manner of HdrHistogram: values
+ * below 64 are counted exactly, larger ones in 32 buckets per power of two,
+ * so every value is known within about 3%, from nanoseconds to hours.
+ */
+struct latency_histogram
+{
+    constexpr static std::size_t sub_buckets = 32;
+    constexpr static std::size_t buckets = 59 * sub_buckets + sub_buckets;
+
+    latency_histogram() : _counts(buckets)
+    {
+    }
+
+    static std::size_t bucket_of(std::uint64_t value)
+    {
+        if (value < 2 * sub_buckets)
+            return value;
+
+        const auto shift = 63 - __builtin_clzll(value) - 5;
+        return shift * sub_buckets + (value >> shift);
+    }
+
+    /**
+     * The smallest and the largest value counted in the bucket.
+     */
+    static std::uint64_t lowest_of(std::size_t bucket)
+    {
+        if (bucket < 2 * sub_buckets)
+            return bucket;
+
+        const auto shift = bucket / sub_buckets - 1;
+        return std::uint64_t(bucket % sub_buckets + sub_buckets) << shift;
+    }
+
+    static std::uint64_t highest_of(std::size_t bucket)
+    {
+        if (bucket < 2 * sub_buckets)
+            return bucket;
+
+        return lowest_of(bucket) + (std::uint64_t(1) << (bucket / sub_buckets - 1)) - 1;
+    }
+
+    void record(std::uint64_t value, std::uint64_t count = 1)
+    {
+        _counts[bucket_of(value)] += count;
+        _total += count;
+        _max = std::max(_max, value);
+    }
+
+    /**
+     * Records the `value` of a periodic measurement along with the ones
+     * which could not be taken while it was late, each `interval` less.
+     * Otherwise a long stall would count as a single slow wakeup.
+     */
+    void record_corrected(std::uint64_t value, std::uint64_t interval)
+    {
+        record(value);
+        if (interval == 0)
+            return;
+
+        for (auto missed = value; missed > interval;)
+        {
+            missed -= interval;
+            record(missed);
+        }
+    }
+
+    /**
+     * The value below which `quantile` (0..1) of the recorded ones are, as
+     * the highest value of its bucket, 0 when nothing was recorded.
+     */
+    std::uint64_t percentile(double quantile) const
+    {
+        if (!_total)
+            return 0;
+
+        const auto wanted = std::max<std::uint64_t>(1, std::uint64_t(quantile * _total + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < _counts.size(); i++)
+        {
+            seen += _counts[i];
+            if (seen >= wanted)
+                return std::min(highest_of(i), _max);
+        }
+        return _max;
+    }
+
+    void merge(const latency_histogram& other)
+    {
+        for (std::size_t i = 0; i < _counts.size(); i++)
+            _counts[i] += other._counts[i];
+        _total += other._total;
+        _max = std::max(_max, other._max);
+    }
+
+    void reset()
+    {
+        std::fill(_counts.begin(), _counts.end(), 0);
+        _total = 0;
+        _max = 0;
+    }
+
+    std::uint64_t count() const
+    {
+        return _total;
+    }
+
+    std::uint64_t max() const
+    {
+        return _max;
+    }
+
+private:
+    std::vector<std::uint64_t> _counts;
+    std::uint64_t _total = 0;
+    std::uint64_t _max = 0;
+};
+
+/**
+ * One line summary of the histogram, in microseconds.
+ */
+inline std::ostream& operator<<(std::ostream& os, const latency_histogram& h)
+{
+    return os << h.count() << " wakeups, p50 " << h.percentile(0.5) / 1000 << "us, p99 " << h.percentile(0.99) / 1000
+              << "us, p99.9 " << h.percentile(0.999) / 1000 << "us, max " << h.max() / 1000 << "us";
+}
+
+/**
+ * `SCHED_OTHER` thread pinned to a cpu which wakes up on a timerfd every
+ * `interval` and measures how late it is against the deadline. When the cpu
+ * is starved by realtime work the wakeups come late or not at all, which is
+ * what `lateness` tells the realtime thread watching it.
+ *
+ * Every `report_interval` the thread writes the histogram of its wakeup
+ * latencies to the standard error and starts a new one, 0 turns it off.
+ */
+struct watchdog
+{
+    using clock = std::chrono::steady_clock;
+
+    watchdog(std::size_t cpu, std::chrono::nanoseconds interval, std::chrono::seconds report_interval)
+        : _cpu(cpu), _interval(interval), _report_interval(report_interval)
+    {
+        _timer = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (_timer == -1)
+            throw std::runtime_error{"could not create watchdog timer"};
+
+        _deadline.store(now() + _interval.count(), std::memory_order_relaxed);
+        _thread = std::thread{[this] { run(); }};
+    }
+
+    watchdog(const watchdog&) = delete;
+    watchdog& operator=(const watchdog&) = delete;
+
+    ~watchdog()
+    {
+        std::cerr << "waiting for watchdog thread to stop\n";
+        _running.store(false, std::memory_order_relaxed);
+        _thread.join();
+        ::close(_timer);
+    }
+
+    auto cpu() const
+    {
+        return _cpu;
+    }
+
+    auto interval() const
+    {
+        return _interval;
+    }
+
+    /**
+     * The latest wakeup since the last call, or how late the one the thread
+     * still waits for is already, whichever is more.
+     */
+    std::chrono::nanoseconds lateness()
+    {
+        const auto worst = _worst.exchange(0, std::memory_order_relaxed);
+        const auto deadline = _deadline.load(std::memory_order_relaxed);
+        const auto t = now();
+        const auto pending = t > deadline ? t - deadline : 0;
+        return std::chrono::nanoseconds{std::max(worst, pending)};
+    }
+
+private:
+    static std::uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+    }
+
+    void run()
+    {
+        set_this_thread_name("poor-watchdog");
+        set_this_thread_affinity(_cpu);
+
+        const std::uint64_t interval = _interval.count();
+        const std::uint64_t report_interval = std::chrono::nanoseconds{_report_interval}.count();
+
+        latency_histogram histogram;
+        auto deadline = _deadline.load(std::memory_order_relaxed);
+        auto next_report = now() + report_interval;
+
+        while (_running.load(std::memory_order_relaxed))
+        {
+            itimerspec spec{};
+            spec.it_value.tv_sec = deadline / 1000000000;
+            spec.it_value.tv_nsec = deadline % 1000000000;
+            ::timerfd_settime(_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+            std::uint64_t expirations;
+            while (::read(_timer, &expirations, sizeof(expirations)) == -1 && errno == EINTR)
+                ;
+
+            const auto t = now();
+            const auto late = t > deadline ? t - deadline : 0;
+            histogram.record_corrected(late, interval);
+
+            auto worst = _worst.load(std::memory_order_relaxed);
+            while (late > worst && !_worst.compare_exchange_weak(worst, late, std::memory_order_relaxed))
+                ;
+
+            // wakeups which were missed are skipped, the deadlines stay on the same grid
+            deadline += (late / interval + 1) * interval;
+            _deadline.store(deadline, std::memory_order_relaxed);
+
+            if (report_interval && t >= next_report)
+            {
+                std::ostringstream ss;
+                ss << "cpu " << _cpu << " wakeup latency over " << _report_interval.count() << "s: " << histogram << '\n';
+                std::cerr << ss.str();
+
+                histogram.reset();
+                next_report = t + report_interval;
+            }
+        }
+    }
+
+    std::size_t _cpu;
+    std::chrono::nanoseconds _interval;
+    std::chrono::seconds _report_interval;
+    int _timer;
+
+    // in nanoseconds of the steady clock
+    std::atomic<std::uint64_t> _deadline{0};
+    std::atomic<std::uint64_t> _worst{0};
+
+    std::atomic<bool> _running{true};
+    std::thread _thread;
+};
+
+} // namespace
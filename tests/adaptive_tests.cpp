@@ -0,0 +1,67 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "catch2/catch.hpp"
+#include "adaptive.hpp"
+
+namespace poor_perf
+{
+
+using namespace std::chrono_literals;
+
+TEST_CASE("adaptive profile lasts while the system is starved")
+{
+    adaptive_limits limits;
+    limits.min_duration = 2s;
+    limits.max_duration = 10s;
+    limits.grace = 500ms;
+
+    // not before the shortest duration, however long ago the starvation was
+    REQUIRE(!next_adaptive_step(limits, 1000, false, 1s, 1s).stop);
+
+    // extended as long as the grace has not passed
+    REQUIRE(!next_adaptive_step(limits, 1000, false, 5s, 0s).stop);
+    REQUIRE(!next_adaptive_step(limits, 1000, false, 5s, 499ms).stop);
+    REQUIRE(next_adaptive_step(limits, 1000, false, 5s, 500ms).stop);
+    REQUIRE(next_adaptive_step(limits, 1000, false, 2s, 2s).stop);
+
+    // but not longer than the longest one
+    REQUIRE(next_adaptive_step(limits, 1000, false, 10s, 0s).stop);
+}
+
+TEST_CASE("adaptive profile ramps its sampling down")
+{
+    adaptive_limits limits;
+    limits.max_duration = 1000s;
+    limits.ramp_down = 2s;
+
+    SECTION("a frequency is halved")
+    {
+        REQUIRE(next_adaptive_step(limits, 1000, false, 1s, 0s).rate == 1000);
+        REQUIRE(next_adaptive_step(limits, 1000, false, 2s, 0s).rate == 500);
+        REQUIRE(next_adaptive_step(limits, 1000, false, 5s, 0s).rate == 250);
+        REQUIRE(next_adaptive_step(limits, 1000, false, 900s, 0s).rate == lowest_ramped_frequency);
+
+        // a low one is not raised to the lowest
+        REQUIRE(next_adaptive_step(limits, 50, false, 1s, 0s).rate == 50);
+        REQUIRE(next_adaptive_step(limits, 50, false, 4s, 0s).rate == 50);
+    }
+
+    SECTION("a period is doubled")
+    {
+        REQUIRE(next_adaptive_step(limits, 1000, true, 1s, 0s).rate == 1000);
+        REQUIRE(next_adaptive_step(limits, 1000, true, 4s, 0s).rate == 4000);
+        REQUIRE(next_adaptive_step(limits, 1000, true, 900s, 0s).rate == 1000 << most_ramped_doublings);
+    }
+
+    SECTION("the rate is kept without ramping")
+    {
+        limits.ramp_down = 0s;
+        REQUIRE(next_adaptive_step(limits, 1000, false, 900s, 0s).rate == 1000);
+    }
+}
+
+} // namespace
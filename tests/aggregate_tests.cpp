@@ -0,0 +1,85 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "catch2/catch.hpp"
+#include "aggregate.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+std::string written_by(sample_histogram& histogram)
+{
+    temp_file file;
+    {
+        output_stream output{file.path};
+        histogram.write(output);
+    }
+    return file.contents();
+}
+
+sample_t sample_at(std::uint64_t time, std::uint64_t ip)
+{
+    sample_t ret{};
+    ret.time = time;
+    ret.ip = ip;
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("samples are counted from the most frequent")
+{
+    running_processes_snapshot processes{kernel_symbols{}, {}};
+    sample_histogram histogram{0};
+
+    histogram.add(processes, sample_at(1, 0x10));
+    histogram.add(processes, sample_at(2, 0x20));
+    histogram.add(processes, sample_at(3, 0x20));
+    REQUIRE(histogram.size() == 2);
+
+    REQUIRE(written_by(histogram) ==
+        "$ count;percent;pid;comm;pathname;addr;name\n"
+        "2;66.67;0;<swapper>;-;0x20;-\n"
+        "1;33.33;0;<swapper>;-;0x10;-\n");
+    REQUIRE(histogram.size() == 0);
+}
+
+TEST_CASE("samples counted as many times are ordered by what they hit")
+{
+    running_processes_snapshot processes{kernel_symbols{}, {}};
+    sample_histogram histogram{0};
+
+    histogram.add(processes, sample_at(1, 0x30));
+    histogram.add(processes, sample_at(2, 0x10));
+    histogram.add(processes, sample_at(3, 0x20));
+
+    REQUIRE(written_by(histogram) ==
+        "$ count;percent;pid;comm;pathname;addr;name\n"
+        "1;33.33;0;<swapper>;-;0x10;-\n"
+        "1;33.33;0;<swapper>;-;0x20;-\n"
+        "1;33.33;0;<swapper>;-;0x30;-\n");
+}
+
+TEST_CASE("samples are counted in buckets of time")
+{
+    running_processes_snapshot processes{kernel_symbols{}, {}};
+    sample_histogram histogram{100};
+
+    histogram.add(processes, sample_at(150, 0x10));
+    histogram.add(processes, sample_at(20, 0x10));
+    histogram.add(processes, sample_at(199, 0x10));
+
+    REQUIRE(written_by(histogram) ==
+        "$ bucket;count;percent;pid;comm;pathname;addr;name\n"
+        "0;1;100.00;0;<swapper>;-;0x10;-\n"
+        "100;2;100.00;0;<swapper>;-;0x10;-\n");
+}
+
+} // namespace
@@ -0,0 +1,313 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perf.hpp"
+#include "proc.hpp"
+#include "output.hpp"
+#include "samples.hpp"
+#include "binary.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+/**
+ * Time per item next to the time per iteration, in seconds in the machine
+ * readable output.
+ */
+void set_time_per(benchmark::State& state, const char* name, std::size_t items_per_iteration)
+{
+    state.SetItemsProcessed(state.iterations() * items_per_iteration);
+    state.counters[name] = benchmark::Counter(double(items_per_iteration),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+/**
+ * Ring in plain memory, filled once the way the kernel does it so that the
+ * records wrap around its end, and read again on every iteration.
+ */
+struct fake_ring
+{
+    constexpr static std::size_t size = 64 * 4096;
+
+    fake_ring() : data(size)
+    {
+        // the first records are written just before the end of the ring
+        metadata.data_head = size - 1000;
+        metadata.data_tail = metadata.data_head;
+        start = metadata.data_head;
+    }
+
+    void write_sample(std::uint64_t ip, std::uint64_t frames)
+    {
+        std::vector<std::uint64_t> record;
+        perf_event_header header{};
+        header.type = PERF_RECORD_SAMPLE;
+
+        // ip, pid and tid, time, cpu and res, then the call chain
+        record.resize(1);
+        record.push_back(ip);
+        record.push_back(std::uint64_t(ip % 1000) << 32 | (ip % 1000));
+        record.push_back(metadata.data_head);
+        record.push_back(0);
+        if (frames)
+        {
+            record.push_back(frames);
+            for (std::uint64_t i = 0; i < frames; i++)
+                record.push_back(ip + i);
+        }
+
+        header.size = static_cast<std::uint16_t>(record.size() * sizeof(std::uint64_t));
+        ::memcpy(record.data(), &header, sizeof(header));
+        write(record.data(), header.size);
+    }
+
+    /**
+     * Fills the whole ring with samples and what is left at its end with
+     * context switch records, which have no body. Returns how many samples
+     * fit.
+     */
+    std::size_t fill(std::uint64_t frames)
+    {
+        // header, ip, pid and tid, time, cpu and res, then the call chain
+        const auto sample_size = (5 + (frames ? 1 + frames : 0)) * sizeof(std::uint64_t);
+
+        std::size_t ret = 0;
+        while (metadata.data_head - start + sample_size <= size)
+        {
+            write_sample(0x400000 + ret * 16, frames);
+            ret++;
+        }
+
+        perf_event_header header{};
+        header.type = PERF_RECORD_SWITCH;
+        header.size = sizeof(header);
+        while (metadata.data_head - start < size)
+            write(&header, sizeof(header));
+        return ret;
+    }
+
+    void write(const void* p, std::size_t bytes)
+    {
+        auto from = reinterpret_cast<const char*>(p);
+        for (std::size_t i = 0; i < bytes; i++)
+            data[(metadata.data_head + i) % size] = from[i];
+        metadata.data_head += bytes;
+    }
+
+    /**
+     * Makes the records unread again: the ring is full, so the very same
+     * ones follow those which were read when the head moves by its size.
+     */
+    void rewind()
+    {
+        metadata.data_head += size;
+    }
+
+    perf_event_mmap_page metadata{};
+    std::vector<char> data;
+    std::uint64_t start;
+};
+
+void ring_reader_read(benchmark::State& state)
+{
+    fake_ring ring;
+    const auto records = ring.fill(0);
+    auto reader = std::make_unique<ring_reader>(&ring.metadata, ring.data.data(), ring.size);
+    for (auto _ : state)
+    {
+        std::uint64_t bytes = 0;
+        reader->read([&](const perf_event_header& header) { bytes += header.size; });
+        benchmark::DoNotOptimize(bytes);
+        ring.rewind();
+    }
+    set_time_per(state, "per_record", records);
+}
+BENCHMARK(ring_reader_read);
+
+template<std::uint64_t Type>
+void read_records_decode(benchmark::State& state)
+{
+    const std::uint64_t frames = state.range(0);
+    fake_ring ring;
+    const auto samples = ring.fill(frames);
+    ring_stats stats;
+    auto reader = std::make_unique<ring_reader>(&ring.metadata, ring.data.data(), ring.size);
+
+    for (auto _ : state)
+    {
+        std::uint64_t sum = 0;
+        read_records<Type>(*reader, stats, [&](const auto& sample) { sum += sample.ip + sample.time; },
+            [](const perf_event_header&, const char*) {});
+        benchmark::DoNotOptimize(sum);
+        ring.rewind();
+    }
+    set_time_per(state, "per_sample", samples);
+}
+BENCHMARK_TEMPLATE(read_records_decode, sample_t::type)->Arg(0);
+BENCHMARK_TEMPLATE(read_records_decode, callchain_sample_t::type)->Arg(4)->Arg(32);
+
+/**
+ * Synthetic kallsyms about as large as the one of a distribution kernel.
+ */
+struct fake_kallsyms
+{
+    constexpr static std::size_t symbols = 120000;
+    constexpr static std::uintptr_t first = 0xffffffff81000000;
+
+    fake_kallsyms()
+    {
+        std::ofstream f{path};
+        for (std::size_t i = 0; i < symbols; i++)
+        {
+            char line[128];
+            auto module = i % 10 == 0 ? "\t[module" + std::to_string(i % 50) + "]" : std::string{};
+            std::snprintf(line, sizeof(line), "%lx t function_number_%zu%s\n", first + i * 0x100, i, module.c_str());
+            f << line;
+        }
+    }
+
+    ~fake_kallsyms()
+    {
+        std::remove(path);
+    }
+
+    const char* path = "benchmarks.kallsyms";
+};
+
+void kernel_symbols_load(benchmark::State& state)
+{
+    fake_kallsyms kallsyms;
+    for (auto _ : state)
+    {
+        kernel_symbols symbols{kallsyms.path};
+        benchmark::DoNotOptimize(symbols.size());
+    }
+    set_time_per(state, "per_symbol", kallsyms.symbols);
+}
+BENCHMARK(kernel_symbols_load)->Unit(benchmark::kMillisecond);
+
+void kernel_symbols_find(benchmark::State& state)
+{
+    fake_kallsyms kallsyms;
+    kernel_symbols symbols{kallsyms.path};
+
+    std::mt19937_64 random{42};
+    std::vector<std::uintptr_t> ips(4096);
+    for (auto& ip : ips)
+        ip = kallsyms.first + random() % (kallsyms.symbols * 0x100);
+
+    for (auto _ : state)
+        for (auto ip : ips)
+            benchmark::DoNotOptimize(symbols.find(ip));
+    set_time_per(state, "per_lookup", ips.size());
+}
+BENCHMARK(kernel_symbols_find);
+
+/**
+ * Snapshot of this machine with `processes` more made up ones, each with
+ * `regions` executable mappings of files shared among them.
+ */
+struct fake_processes
+{
+    constexpr static std::uint32_t first_pid = 10000000;
+
+    fake_processes(std::uint32_t processes, std::uint32_t regions)
+    {
+        snapshot.wait_until_loaded();
+
+        std::mt19937_64 random{42};
+        for (std::uint32_t pid = first_pid; pid < first_pid + processes; pid++)
+        {
+            snapshot.on_comm(pid, "process" + std::to_string(pid), false);
+
+            std::uintptr_t start = 0x7f0000000000;
+            for (std::uint32_t i = 0; i < regions; i++)
+            {
+                const auto size = 0x1000 * (1 + random() % 64);
+                snapshot.on_mmap(pid, region_t{start, start + size, "r-xp", 0, "/usr/lib/fake/lib" + std::to_string(i) + ".so"});
+                ips.emplace_back(pid, start + random() % size);
+                start += size + 0x1000;
+            }
+        }
+        std::shuffle(ips.begin(), ips.end(), random);
+        ips.resize(std::min<std::size_t>(ips.size(), 4096));
+    }
+
+    running_processes_snapshot snapshot;
+    std::vector<std::pair<std::uint32_t, std::uintptr_t>> ips;
+};
+
+void find_symbol(benchmark::State& state)
+{
+    fake_processes processes(state.range(0), state.range(1));
+
+    for (auto _ : state)
+        for (auto [pid, ip] : processes.ips)
+            benchmark::DoNotOptimize(processes.snapshot.find_symbol(pid, ip));
+    set_time_per(state, "per_lookup", processes.ips.size());
+}
+BENCHMARK(find_symbol)->Args({100, 50})->Args({1000, 200});
+
+template<class Write>
+void write_samples(benchmark::State& state, Write&& write)
+{
+    symbol_t s;
+    s.comm = "chrome";
+    s.pathname = "/usr/lib/x86_64-linux-gnu/libc.so.6";
+    s.name = "__memmove_avx_unaligned_erms";
+
+    sample_t sample{};
+    sample.pid = 3607;
+    sample.time = 10210788186300;
+
+    const std::size_t samples = 1000;
+    for (auto _ : state)
+    {
+        for (std::size_t i = 0; i < samples; i++)
+        {
+            sample.time += 1000;
+            s.addr = 0x9bb0 + i * 8;
+            write(sample, s);
+        }
+    }
+    set_time_per(state, "per_sample", samples);
+}
+
+void write_sample_lines(benchmark::State& state)
+{
+    output_stream output{"/dev/null"};
+    write_samples(state, [&](const sample_t& sample, const symbol_t& s) { write_sample_line(output, sample, s, "cycles"); });
+}
+BENCHMARK(write_sample_lines);
+
+void write_binary_samples(benchmark::State& state)
+{
+    output_stream output{"/dev/null"};
+    binary_profile_writer writer{output, "cycles"};
+    write_samples(state, [&](const sample_t& sample, const symbol_t& s)
+    {
+        writer.write(sample.time, sample.cpu, sample.pid, s);
+    });
+}
+BENCHMARK(write_binary_samples);
+
+} // namespace
+
+} // namespace
+
+BENCHMARK_MAIN();
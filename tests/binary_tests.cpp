@@ -0,0 +1,105 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <utility>
+
+#include "catch2/catch.hpp"
+#include "binary.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+std::string as_text(std::string_view data)
+{
+    std::string ret;
+    REQUIRE(binary_to_text(data, [&](std::string_view line) { ret += line; }));
+    return ret;
+}
+
+symbol_t symbol(std::string_view comm, std::string_view pathname, std::uintptr_t addr, std::string_view name)
+{
+    symbol_t ret;
+    ret.comm = comm;
+    ret.pathname = pathname;
+    ret.addr = addr;
+    ret.name = name;
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("binary profile is converted back to text")
+{
+    temp_file file;
+    {
+        output_stream output{file.path};
+        binary_profile_writer writer{output, "cycles"};
+        writer.write(100, 1, 42, symbol("bash", "/bin/bash", 0x1234, "main"));
+        writer.write(200, 0, 42, symbol("bash", "/bin/bash", 0x1240, "main"));
+        output.message("done");
+    }
+
+    auto data = file.contents();
+
+    // the message is written with a timestamp
+    auto text = as_text(data);
+    auto messages = text.find("# ");
+    REQUIRE(messages != std::string::npos);
+    REQUIRE(text.substr(messages).find(": done\n") != std::string::npos);
+    REQUIRE(text.substr(0, messages) ==
+        "$ time;cpu;pid;comm;pathname;addr;name;event\n"
+        "100;1;42;bash;/bin/bash;0x1234;main;cycles\n"
+        "200;0;42;bash;/bin/bash;0x1240;main;cycles\n");
+
+    // strings are written once
+    REQUIRE(data.find("/bin/bash") == data.rfind("/bin/bash"));
+}
+
+TEST_CASE("every profile appended to the binary file has its own strings")
+{
+    temp_file file;
+    for (auto [comm, event] : {std::pair{"first", "cycles"}, std::pair{"second", "cpu-clock"}})
+    {
+        output_stream output{file.path};
+        binary_profile_writer writer{output, event};
+        writer.write(1, 0, 1, symbol(comm, "-", 0x10, "-"));
+    }
+
+    auto data = file.contents();
+
+    REQUIRE(data.find(binary_magic) == 0);
+    REQUIRE(data.rfind(binary_magic) == 0);
+    REQUIRE(as_text(data) ==
+        "$ time;cpu;pid;comm;pathname;addr;name;event\n"
+        "1;0;1;first;-;0x10;-;cycles\n"
+        "$ time;cpu;pid;comm;pathname;addr;name;event\n"
+        "1;0;1;second;-;0x10;-;cpu-clock\n");
+}
+
+TEST_CASE("truncated binary profile is read up to its last complete record")
+{
+    temp_file file;
+    {
+        output_stream output{file.path};
+        binary_profile_writer writer{output, "cycles"};
+        writer.write(1, 0, 1, symbol("a", "-", 0x10, "-"));
+        writer.write(2, 0, 1, symbol("a", "-", 0x20, "-"));
+    }
+
+    auto data = file.contents();
+
+    const std::string first = "$ time;cpu;pid;comm;pathname;addr;name;event\n1;0;1;a;-;0x10;-;cycles\n";
+    for (std::size_t cut = 1; cut <= binary_sample_size; cut++)
+        REQUIRE(as_text(std::string_view{data}.substr(0, data.size() - cut)) == first);
+
+    REQUIRE(!binary_to_text("$ time;pid\n", [](std::string_view) {}));
+}
+
+} // namespace
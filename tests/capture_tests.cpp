@@ -0,0 +1,139 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "capture.hpp"
+#include "tracker.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+template<class T>
+void append(std::string& records, const T& value)
+{
+    records.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void append_sample(std::string& records, std::uint32_t pid, std::uint64_t time, std::uint64_t ip)
+{
+    perf_event_header header{};
+    header.type = PERF_RECORD_SAMPLE;
+    header.size = sizeof(header) + sizeof(sample_t);
+
+    sample_t sample{};
+    sample.ip = ip;
+    sample.pid = sample.tid = pid;
+    sample.time = time;
+
+    append(records, header);
+    append(records, sample);
+}
+
+/**
+ * As written with `tracking_attr`, followed by pid, tid and time.
+ */
+void append_comm(std::string& records, std::uint32_t pid, std::uint64_t time, const char (&comm)[8])
+{
+    perf_event_header header{};
+    header.type = PERF_RECORD_COMM;
+    header.size = sizeof(header) + 8 + sizeof(comm) + 16;
+
+    append(records, header);
+    append(records, pid);
+    append(records, pid);
+    append(records, comm);
+    append(records, pid);
+    append(records, pid);
+    append(records, time);
+}
+
+} // namespace
+
+TEST_CASE("captured records are read back by cpu")
+{
+    std::string samples;
+    append_sample(samples, 10, 100, 0x1000);
+    append_sample(samples, 10, 200, 0x2000);
+
+    std::string tracking;
+    append_comm(tracking, 10, 150, "renamed");
+
+    temp_file file;
+    {
+        capture_writer capture{file.path};
+        capture.event("cpu-clock");
+        capture.samples(1, sample_t::type, std::string_view{samples}.substr(0, samples.size() / 2));
+        capture.tracking(3, tracking);
+        capture.samples(1, sample_t::type, std::string_view{samples}.substr(samples.size() / 2));
+    }
+
+    auto contents = read_capture(file.path);
+
+    REQUIRE(contents.event == "cpu-clock");
+    REQUIRE(contents.samples.size() == 1);
+    REQUIRE(contents.samples[1].sample_type == sample_t::type);
+    REQUIRE(contents.samples[1].records == samples);
+    REQUIRE(contents.tracking.size() == 1);
+    REQUIRE(contents.tracking[3] == tracking);
+
+    // the very same decoding as for a live ring
+    replayed_ring ring{contents.samples[1].records};
+    ring_stats stats;
+    std::vector<std::uint64_t> ips;
+    read_records(ring.reader(), stats, [&](const sample_t& s) { ips.push_back(s.ip); },
+        [](const perf_event_header&, const char*) {});
+    REQUIRE(ips == std::vector<std::uint64_t>{0x1000, 0x2000});
+}
+
+TEST_CASE("replayed samples are symbolized with the captured processes")
+{
+    scanned_process process;
+    process.pid = 10;
+    process.comm = "original";
+    process.maps = parse_maps("00400000-00401000 r-xp 00000000 08:01 1234 /usr/bin/app\n"
+                              "00600000-00601000 rw-p 00000000 08:01 1234 /usr/bin/app\n");
+    REQUIRE(process.maps.size() == 1);
+
+    running_processes_snapshot processes{kernel_symbols::from_text(
+        "ffffffff81000000 T start_kernel\nffffffff81001000 T _etext\n"), {process}};
+
+    std::string tracking;
+    append_comm(tracking, 10, 150, "renamed");
+
+    process_tracker tracker;
+    replayed_ring ring{tracking};
+    tracker.read(ring.reader());
+
+    tracker.apply_until(100, processes);
+    auto s = processes.find_symbol(10, 0x400010);
+    REQUIRE(s.comm == "original");
+    REQUIRE(s.pathname == "/usr/bin/app");
+    REQUIRE(s.addr == 0x10);
+
+    tracker.apply_until(200, processes);
+    REQUIRE(processes.find_symbol(10, 0x400010).comm == "renamed");
+    REQUIRE(processes.find_symbol(10, 0xffffffff81000010).name == "start_kernel");
+}
+
+TEST_CASE("file which is not a capture is refused")
+{
+    temp_file file;
+    {
+        output_stream output{file.path};
+        output.write("$ time;cpu;pid;comm;pathname;addr;name\n");
+    }
+
+    REQUIRE_THROWS(read_capture(file.path));
+}
+
+} // namespace
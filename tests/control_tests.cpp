@@ -0,0 +1,192 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "catch2/catch.hpp"
+#include "control.hpp"
+#include "output.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+const char* path = "control_tests.sock";
+
+int connect_to(const char* path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    REQUIRE(::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0);
+    return fd;
+}
+
+std::string receive(int fd)
+{
+    char buffer[256];
+    auto n = ::read(fd, buffer, sizeof(buffer));
+    return n > 0 ? std::string{buffer, std::size_t(n)} : std::string{};
+}
+
+} // namespace
+
+TEST_CASE("control requests are parsed")
+{
+    auto request = parse_control_request("start  cpu=0-3 output=- stream");
+    REQUIRE(request.command == "start");
+    REQUIRE(request.args.size() == 3);
+    REQUIRE(request.args["cpu"] == "0-3");
+    REQUIRE(request.args["output"] == "-");
+    REQUIRE(request.args.count("stream"));
+
+    REQUIRE(parse_control_request("").command.empty());
+    REQUIRE(parse_control_request("stats").args.empty());
+}
+
+TEST_CASE("control clients are served by the event loop")
+{
+    volatile sig_atomic_t signal_status = 0;
+    event_loop loop{signal_status};
+    control_server server{path};
+    server.add_to(loop);
+
+    std::vector<std::string> commands;
+    auto serve = [&]
+    {
+        loop.run_once([&](int fd)
+        {
+            REQUIRE(server.handle(loop, fd, [&](const std::shared_ptr<control_client>& client, const control_request& r)
+            {
+                commands.push_back(r.command);
+                client->reply("ok " + r.command + "\n");
+            }));
+        }, std::chrono::milliseconds{100});
+    };
+
+    int client = connect_to(path);
+    serve();
+    REQUIRE(server.clients() == 1);
+
+    // a line may come in pieces, or many of them at once
+    write_all(client, "sta", 3);
+    serve();
+    REQUIRE(commands.empty());
+    write_all(client, "ts\r\nstop\n", 9);
+    serve();
+    REQUIRE(commands == std::vector<std::string>{"stats", "stop"});
+    REQUIRE(receive(client) == "ok stats\nok stop\n");
+
+    ::close(client);
+    serve();
+    REQUIRE(server.clients() == 0);
+}
+
+TEST_CASE("output is handed over to a sink")
+{
+    std::string sunk;
+    {
+        output_stream output{[&](std::string_view data) { sunk += data; }};
+        output.write("1 2 3\n");
+    }
+    REQUIRE(sunk == "1 2 3\n");
+}
+
+TEST_CASE("client which does not read is not waited for")
+{
+    volatile sig_atomic_t signal_status = 0;
+    event_loop loop{signal_status};
+    control_server server{path};
+    server.add_to(loop);
+
+    std::shared_ptr<control_client> connected;
+    auto serve = [&]
+    {
+        loop.run_once([&](int fd)
+        {
+            server.handle(loop, fd, [&](const std::shared_ptr<control_client>& c, const control_request&) { connected = c; });
+        }, std::chrono::milliseconds{100});
+    };
+
+    int client = connect_to(path);
+    serve();
+    write_all(client, "start\n", 6);
+    serve();
+    REQUIRE(connected);
+
+    // more than the socket takes is kept, up to a limit
+    const std::string chunk(64 * 1024, 'x');
+    REQUIRE(connected->reply(chunk));
+    std::size_t sent = chunk.size();
+    while (connected->reply(chunk))
+    {
+        sent += chunk.size();
+        REQUIRE(sent <= control_client::max_outgoing + (8 << 20));
+    }
+    REQUIRE(connected->failed());
+    REQUIRE(!connected->sending());
+
+    // nothing is left to be sent to it
+    server.disconnect(connected);
+    serve();
+    REQUIRE(server.clients() == 0);
+    ::close(client);
+}
+
+TEST_CASE("what is left for a disconnected client is still sent")
+{
+    volatile sig_atomic_t signal_status = 0;
+    event_loop loop{signal_status};
+    control_server server{path};
+    server.add_to(loop);
+
+    std::shared_ptr<control_client> connected;
+    auto serve = [&]
+    {
+        loop.run_once([&](int fd)
+        {
+            server.handle(loop, fd, [&](const std::shared_ptr<control_client>& c, const control_request&) { connected = c; });
+        }, std::chrono::milliseconds{100});
+    };
+
+    int client = connect_to(path);
+    serve();
+    write_all(client, "start\n", 6);
+    serve();
+
+    const std::string chunk(1 << 20, 'x');
+    REQUIRE(connected->reply(chunk));
+    REQUIRE(connected->sending());
+    server.disconnect(connected);
+    connected.reset();
+
+    std::size_t received = 0;
+    char buffer[65536];
+    while (received < chunk.size())
+    {
+        serve();
+        auto n = ::read(client, buffer, sizeof(buffer));
+        REQUIRE(n > 0);
+        received += n;
+    }
+
+    // and then it is closed
+    serve();
+    REQUIRE(::read(client, buffer, sizeof(buffer)) == 0);
+    ::close(client);
+}
+
+} // namespace
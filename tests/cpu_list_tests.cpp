@@ -0,0 +1,52 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <sstream>
+
+#include "catch2/catch.hpp"
+#include "cpu_list.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("single cpu")
+{
+    auto cpus = parse_cpu_list("3");
+    REQUIRE(cpus.cpus == std::vector<std::size_t>{3});
+}
+
+TEST_CASE("cpu ranges and lists")
+{
+    auto cpus = parse_cpu_list("0-2,5,8-9");
+    REQUIRE(cpus.cpus == std::vector<std::size_t>{0, 1, 2, 5, 8, 9});
+
+    std::stringstream ss;
+    ss << cpus;
+    REQUIRE(ss.str() == "0-2,5,8-9");
+}
+
+TEST_CASE("duplicated cpus are merged")
+{
+    auto cpus = parse_cpu_list("4,1-4");
+    REQUIRE(cpus.cpus == std::vector<std::size_t>{1, 2, 3, 4});
+}
+
+TEST_CASE("invalid cpu lists")
+{
+    REQUIRE_THROWS(parse_cpu_list(""));
+    REQUIRE_THROWS(parse_cpu_list("1,"));
+    REQUIRE_THROWS(parse_cpu_list("3-1"));
+    REQUIRE_THROWS(parse_cpu_list("x"));
+}
+
+TEST_CASE("cpus except other cpus")
+{
+    auto cpus = except(parse_cpu_list("0-7"), parse_cpu_list("1,3-5,9"));
+    REQUIRE(cpus.cpus == std::vector<std::size_t>{0, 2, 6, 7});
+    REQUIRE(except(parse_cpu_list("2"), parse_cpu_list("2")).size() == 0);
+}
+
+} // namespace
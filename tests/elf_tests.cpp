@@ -0,0 +1,84 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "catch2/catch.hpp"
+#include "elf.hpp"
+#include "proc.hpp"
+
+namespace poor_perf
+{
+
+__attribute__((noinline)) int elf_tests_marker(int x)
+{
+    return x * 3 + 1;
+}
+
+TEST_CASE("functions of the running binary are found by their file offset")
+{
+    const auto ip = reinterpret_cast<std::uintptr_t>(&elf_tests_marker) + 1;
+
+    std::uint64_t offset = 0;
+    std::string pathname;
+    for (const auto& region : read_maps("/proc/self/maps"))
+    {
+        if (region.contains(ip))
+        {
+            offset = ip - region.start + region.offset;
+            pathname = region.pathname;
+        }
+    }
+    REQUIRE(!pathname.empty());
+
+    elf_symbols symbols{pathname};
+    REQUIRE(symbols.size() > 0);
+    REQUIRE(symbols.find(offset) == "poor_perf::elf_tests_marker(int)");
+    REQUIRE(symbols.find(0).empty());
+}
+
+TEST_CASE("files are parsed once however many paths refer to them")
+{
+    elf_symbol_cache cache;
+    auto a = cache.get(0, "/proc/self/exe");
+    REQUIRE(a);
+    REQUIRE(cache.get(0, "/proc/self/exe") == a);
+
+    cache.forget_paths();
+    REQUIRE(cache.get(3, "/proc/self/exe") == a);
+    REQUIRE(cache.size() == 1);
+
+    REQUIRE(cache.get(1, "/proc/self/status") == nullptr);
+    REQUIRE(cache.get(2, "[vdso]") == nullptr);
+}
+
+TEST_CASE("mapped files are found by their identity rather than by their path")
+{
+    const auto ip = reinterpret_cast<std::uintptr_t>(&elf_tests_marker) + 1;
+    const auto pid = static_cast<std::uint32_t>(::getpid());
+
+    const region_t* mapped = nullptr;
+    const auto maps = read_maps("/proc/self/maps");
+    for (const auto& region : maps)
+        if (region.contains(ip))
+            mapped = &region;
+    REQUIRE(mapped);
+    const auto offset = ip - mapped->start + mapped->offset;
+
+    elf_symbol_cache cache;
+    auto a = cache.get(mapped->dev, mapped->inode, mapped->pathname, pid, mapped->start, mapped->end);
+    REQUIRE(a);
+    REQUIRE(a->find(offset) == "poor_perf::elf_tests_marker(int)");
+
+    // the file at the path is some other one now, the mapping still refers to the old one
+    elf_symbol_cache replaced;
+    auto b = replaced.get(mapped->dev, mapped->inode, "/proc/self/status", pid, mapped->start, mapped->end);
+    REQUIRE(b);
+    REQUIRE(b->find(offset) == "poor_perf::elf_tests_marker(int)");
+
+    // and when the mapping is gone too, nothing is made up
+    REQUIRE(replaced.get(mapped->dev, mapped->inode + 1, mapped->pathname, pid, 0, 0x1000) == nullptr);
+}
+
+} // namespace
@@ -0,0 +1,122 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "perf.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("events are parsed by their perf names")
+{
+    auto cycles = parse_event("cycles");
+    REQUIRE(cycles.hardware());
+    REQUIRE(cycles.config == PERF_COUNT_HW_CPU_CYCLES);
+
+    REQUIRE(parse_event("instructions").config == PERF_COUNT_HW_INSTRUCTIONS);
+    REQUIRE(parse_event("cache-misses").config == PERF_COUNT_HW_CACHE_MISSES);
+    REQUIRE(parse_event("cpu-clock").type == PERF_TYPE_SOFTWARE);
+    REQUIRE(parse_event("task-clock").config == PERF_COUNT_SW_TASK_CLOCK);
+
+    REQUIRE_THROWS(parse_event("cycle"));
+    REQUIRE_THROWS(parse_event(""));
+    REQUIRE_THROWS(parse_event("sched:"));
+    REQUIRE_THROWS(parse_event("../../x:y"));
+}
+
+TEST_CASE("tracepoint ids are looked up in tracefs")
+{
+    const std::string dir = "events_tests.tracing";
+    ::mkdir(dir.c_str(), 0755);
+    ::mkdir((dir + "/events").c_str(), 0755);
+    ::mkdir((dir + "/events/sched").c_str(), 0755);
+    ::mkdir((dir + "/events/sched/sched_switch").c_str(), 0755);
+    std::ofstream{dir + "/events/sched/sched_switch/id"} << "316\n";
+
+    auto event = parse_event("sched:sched_switch", {"/nonexistent", dir});
+    REQUIRE(event.tracepoint());
+    REQUIRE(event.config == 316);
+    REQUIRE(event.name == "sched:sched_switch");
+
+    REQUIRE_THROWS(parse_event("sched:sched_wakeup", {dir}));
+
+    std::remove((dir + "/events/sched/sched_switch/id").c_str());
+    ::rmdir((dir + "/events/sched/sched_switch").c_str());
+    ::rmdir((dir + "/events/sched").c_str());
+    ::rmdir((dir + "/events").c_str());
+    ::rmdir(dir.c_str());
+}
+
+TEST_CASE("the first event of the list is sampled")
+{
+    auto events = parse_event_list("cpu-clock,cycles,instructions");
+    REQUIRE(events.size() == 3);
+    REQUIRE(events.sampled().name == "cpu-clock");
+
+    std::ostringstream os;
+    os << events;
+    REQUIRE(os.str() == "cpu-clock,cycles,instructions");
+
+    std::istringstream is{"cycles,nonsense"};
+    REQUIRE(!(is >> events));
+    REQUIRE_THROWS(parse_event_list("cycles,"));
+
+    // cycles by default
+    REQUIRE(event_list{}.sampled().name == "cycles");
+}
+
+TEST_CASE("events are sampled with a frequency or a period")
+{
+    sampling_spec spec;
+    auto attr = sampling_attr(spec);
+    REQUIRE(attr.freq == 1);
+    REQUIRE(attr.sample_freq == default_sampling_frequency);
+    REQUIRE(attr.type == PERF_TYPE_HARDWARE);
+    REQUIRE(attr.read_format & PERF_FORMAT_GROUP);
+
+    spec.period = 100000;
+    attr = sampling_attr(spec);
+    REQUIRE(attr.freq == 0);
+    REQUIRE(attr.sample_period == 100000);
+
+    std::ostringstream os;
+    os << spec;
+    REQUIRE(os.str() == "cycles every 100000 events");
+
+    // every tracepoint hit unless told otherwise
+    spec.events.events = {perf_event_spec{"sched:sched_switch", PERF_TYPE_TRACEPOINT, 316}};
+    spec.period = 0;
+    REQUIRE(sampling_attr(spec).sample_period == 1);
+}
+
+TEST_CASE("events without hardware counters fall back to cpu-clock")
+{
+    sampling_spec spec;
+    spec.events = parse_event_list("cycles,task-clock,instructions");
+
+    auto lines = fall_back_to_software(spec, 0);
+    if (spec.events.sampled().name == "cycles")
+    {
+        // there is a PMU, or we are not allowed to find out
+        REQUIRE(lines.size() <= 1);
+        return;
+    }
+
+    REQUIRE(spec.events.sampled().name == "cpu-clock");
+    REQUIRE(spec.events.size() == 2);
+    REQUIRE(spec.events.events[1].name == "task-clock");
+    REQUIRE(lines.size() == 2);
+    REQUIRE(lines[0] == "no hardware counters for cycles, sampling cpu-clock instead");
+}
+
+} // namespace
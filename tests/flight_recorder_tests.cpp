@@ -0,0 +1,59 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <deque>
+
+#include "catch2/catch.hpp"
+#include "flight_recorder.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+sample_t sample_at(std::uint64_t time)
+{
+    sample_t ret{};
+    ret.time = time;
+    return ret;
+}
+
+std::vector<std::uint64_t> times(const std::deque<profile_sample>& samples)
+{
+    std::vector<std::uint64_t> ret;
+    for (const auto& sample : samples)
+        ret.push_back(sample.time);
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("history keeps the most recent samples")
+{
+    sample_history history{3};
+    for (std::uint64_t time = 1; time <= 5; time++)
+        history.push(sample_at(time));
+    REQUIRE(history.size() == 3);
+
+    std::deque<profile_sample> out;
+    history.take_since(0, out);
+    REQUIRE(times(out) == std::vector<std::uint64_t>{3, 4, 5});
+    REQUIRE(history.size() == 0);
+}
+
+TEST_CASE("history skips samples older than the window")
+{
+    sample_history history{10};
+    for (std::uint64_t time = 1; time <= 5; time++)
+        history.push(sample_at(time * 10));
+
+    std::deque<profile_sample> out;
+    history.take_since(30, out);
+    REQUIRE(times(out) == std::vector<std::uint64_t>{30, 40, 50});
+}
+
+} // namespace
@@ -0,0 +1,42 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "catch2/catch.hpp"
+#include "folded.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("stacks are folded from the root and counted")
+{
+    temp_file file;
+
+    running_processes_snapshot processes{kernel_symbols{}, {}};
+    folded_stacks stacks;
+
+    // pid 0 is never symbolized so frames are left as addresses
+    profile_sample sample{};
+    sample.pid = 0;
+    sample.ip = 0x10;
+    sample.callchain = {std::uint64_t(PERF_CONTEXT_KERNEL), 0x10, 0x20, 0x30};
+    stacks.add(processes, sample);
+    stacks.add(processes, sample);
+
+    sample.callchain.clear();
+    stacks.add(processes, sample);
+    REQUIRE(stacks.size() == 2);
+
+    {
+        output_stream output{file.path};
+        stacks.write(output);
+    }
+    REQUIRE(stacks.size() == 0);
+
+    REQUIRE(file.contents() == "<swapper>;0x30;0x20;0x10 2\n<swapper>;0x10 1\n");
+}
+
+} // namespace
@@ -0,0 +1,49 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <fstream>
+
+#include "catch2/catch.hpp"
+#include "proc.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("kernel symbols are looked up by address")
+{
+    temp_file file;
+    {
+        std::ofstream f{file.path};
+        f << "ffffffff81000200 T second_symbol\n"
+          << "ffffffff81000000 T first_symbol\n"
+          << "ffffffffc0ffd000 t intel_prepare_plane_fb\t[i915]\n"
+          << "ffffffffc1000000 t drm_open\t[drm]\n";
+    }
+
+    kernel_symbols symbols{file.path};
+
+    REQUIRE(symbols.size() == 4);
+
+    auto s = symbols.find(0xffffffff81000010);
+    REQUIRE(s.addr == 0xffffffff81000000);
+    REQUIRE(s.name == "first_symbol");
+    REQUIRE(s.module == "<kernelmain>");
+
+    s = symbols.find(0xffffffff81000200);
+    REQUIRE(s.name == "second_symbol");
+
+    s = symbols.find(0xffffffffc0ffdc85);
+    REQUIRE(s.name == "intel_prepare_plane_fb");
+    REQUIRE(s.module == "[i915]");
+
+    // past the last symbol
+    s = symbols.find(0xffffffffc1000010);
+    REQUIRE(s.name == "-");
+    REQUIRE(s.module == "<nokernel>");
+}
+
+} // namespace
@@ -0,0 +1,120 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <limits>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "catch2/catch.hpp"
+#include "output.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("numbers are formatted like with iostreams")
+{
+    temp_file file;
+
+    const std::uint64_t values[] = {0, 1, 9, 10, 0xf, 0x10, 0xffffffff81000000, 10210785447776,
+                                    std::numeric_limits<std::uint64_t>::max()};
+    std::ostringstream expected;
+    {
+        output_stream output{file.path};
+        for (auto v : values)
+        {
+            output.write_dec(v).write(';').write("0x").write_hex(v).write('\n');
+            expected << std::dec << v << ";0x" << std::hex << v << '\n';
+        }
+    }
+
+    REQUIRE(file.contents() == expected.str());
+}
+
+TEST_CASE("output longer than the buffer is written whole")
+{
+    temp_file file;
+
+    std::string line(1000, 'x');
+    {
+        output_stream output{file.path};
+        for (int i = 0; i < 1000; i++)
+            output.write(line).write('\n');
+    }
+
+    REQUIRE(file.contents().size() == 1001 * 1000);
+}
+
+TEST_CASE("compressed output is a gzip stream of what was written")
+{
+    temp_file file{".gz"};
+
+    std::string expected;
+    for (int profile = 0; profile < 2; profile++)
+    {
+        output_stream output{file.path, true};
+        output.preallocate(1 << 20);
+        for (int i = 0; i < 100000; i++)
+        {
+            output.write_dec(i).write('\n');
+            expected += std::to_string(i) + '\n';
+        }
+    }
+
+    struct stat st;
+    REQUIRE(::stat(file.path.c_str(), &st) == 0);
+    REQUIRE(std::uint64_t(st.st_size) < expected.size() / 2);
+
+    // appended profiles are concatenated gzip members, which zcat reads as one
+    auto gz = ::gzopen(file.path.c_str(), "rb");
+    REQUIRE(gz);
+    std::string read(expected.size() + 1, '\0');
+    auto n = ::gzread(gz, read.data(), read.size());
+    ::gzclose(gz);
+
+    REQUIRE(n == int(expected.size()));
+    read.resize(n);
+    REQUIRE(read == expected);
+
+    // which is what the report reads too, even when the last one was cut short
+    const auto compressed = file.contents();
+    REQUIRE(gunzip(compressed) == expected);
+    REQUIRE(gunzip(compressed, 10) == expected.substr(0, 10));
+    REQUIRE(expected.find(gunzip(std::string_view{compressed}.substr(0, compressed.size() - 100))) == 0);
+    REQUIRE_THROWS(gunzip("not compressed"));
+}
+
+TEST_CASE("profiles are not appended to a file with the other format")
+{
+    for (bool compress : {false, true})
+    {
+        temp_file text{compress ? ".gz" : ""};
+        {
+            output_stream output{text.path, compress};
+            output.expect_format(false);
+            output.write("$ time;cpu;pid;comm;pathname;addr;name;event\n");
+        }
+        {
+            output_stream output{text.path, compress};
+            REQUIRE_NOTHROW(output.expect_format(false));
+            REQUIRE_THROWS(output.use_binary_format());
+        }
+
+        temp_file binary{compress ? ".gz" : ""};
+        {
+            output_stream output{binary.path, compress};
+            output.use_binary_format();
+        }
+        {
+            output_stream output{binary.path, compress};
+            REQUIRE_THROWS(output.expect_format(false));
+            REQUIRE_NOTHROW(output.use_binary_format());
+        }
+    }
+}
+
+} // namespace
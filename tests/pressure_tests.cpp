@@ -0,0 +1,40 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "pressure.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("cpu pressure of the system and of cgroups")
+{
+    REQUIRE(cpu_pressure_path("") == "/proc/pressure/cpu");
+    REQUIRE(cpu_pressure_path("/sys/fs/cgroup/app.slice") == "/sys/fs/cgroup/app.slice/cpu.pressure");
+    REQUIRE(cpu_pressure_path("app.slice/web") == "/sys/fs/cgroup/app.slice/web/cpu.pressure");
+}
+
+TEST_CASE("pressure trigger is set")
+{
+    // kernels without PSI or containers without access to it
+    if (::access("/proc/pressure/cpu", W_OK) != 0)
+        return;
+
+    pressure_trigger trigger{"/proc/pressure/cpu", std::chrono::milliseconds{500}, std::chrono::seconds{2}};
+    REQUIRE(trigger.fd() != -1);
+    REQUIRE(trigger.current().find("some avg10=") == 0);
+
+    // for a whole window after it fired
+    trigger.fired();
+    REQUIRE(trigger.stalling());
+
+    REQUIRE_THROWS(pressure_trigger{"/proc/pressure/cpu", std::chrono::seconds{3}, std::chrono::seconds{2}});
+    REQUIRE_THROWS(pressure_trigger{"/nonexistent/cpu.pressure", std::chrono::seconds{1}, std::chrono::seconds{2}});
+}
+
+} // namespace
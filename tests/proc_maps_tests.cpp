@@ -18,6 +18,8 @@ TEST_CASE("parse 1")
     REQUIRE(region.perms == "r-xp");
     REQUIRE(region.offset == 0xa);
     REQUIRE(region.pathname == "/usr/bin/python2.7");
+    REQUIRE(region.dev == makedev(0x103, 0x02));
+    REQUIRE(region.inode == 10628889);
     REQUIRE(region.exec());
 }
 
@@ -41,4 +43,13 @@ TEST_CASE("parse 3")
     REQUIRE(region.exec());
 }
 
+TEST_CASE("parse 4")
+{
+    region_t region{"7f1c8a000000-7f1c8a021000 r-xp 00001000 08:01 1234  /opt/my app/libfoo.so (deleted)"};
+    REQUIRE(region.start == 0x7f1c8a000000);
+    REQUIRE(region.offset == 0x1000);
+    REQUIRE(region.pathname == "/opt/my app/libfoo.so");
+    REQUIRE(region.exec());
+}
+
 } // namespace
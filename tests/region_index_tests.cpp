@@ -0,0 +1,98 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <random>
+
+#include "catch2/catch.hpp"
+#include "proc.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("new region splits the one it overlaps")
+{
+    region_index index;
+    index.add({0x1000, 0x5000, 0x0, 1});
+    index.add({0x2000, 0x3000, 0x0, 2});
+
+    const auto& e = index.entries();
+    REQUIRE(e.size() == 3);
+    REQUIRE(e[0].start == 0x1000);
+    REQUIRE(e[0].end == 0x2000);
+    REQUIRE(e[1].pathname == 2);
+    REQUIRE(e[2].start == 0x3000);
+    REQUIRE(e[2].end == 0x5000);
+    REQUIRE(e[2].offset == 0x2000);
+    REQUIRE(e[2].pathname == 1);
+}
+
+TEST_CASE("new region replaces the ones it covers")
+{
+    region_index index;
+    index.add({0x1000, 0x2000, 0x0, 1});
+    index.add({0x2000, 0x3000, 0x0, 2});
+    index.add({0x0, 0x3000, 0x0, 3});
+
+    REQUIRE(index.size() == 1);
+    REQUIRE(index.find(0x1000)->pathname == 3);
+    REQUIRE(index.find(0x3000) == nullptr);
+}
+
+TEST_CASE("same pathname is interned once")
+{
+    string_table t;
+    auto a = t.intern("/usr/lib/libc.so");
+    auto b = t.intern("/usr/bin/python");
+    REQUIRE(t.intern("/usr/lib/libc.so") == a);
+    REQUIRE(a != b);
+    REQUIRE(t.get(b) == "/usr/bin/python");
+    REQUIRE(t.size() == 2);
+}
+
+TEST_CASE("index finds the same regions as linear scan")
+{
+    std::mt19937_64 rng{42};
+    std::vector<region_t> regions;
+    region_index index;
+    string_table pathnames;
+
+    // non overlapping regions with gaps, like in /proc/$PID/maps
+    std::uintptr_t addr = 0x400000;
+    for (int i = 0; i < 2000; i++)
+    {
+        addr += (rng() % 4) * 0x1000;
+        auto size = (1 + rng() % 16) * 0x1000;
+        auto pathname = "/lib/lib" + std::to_string(rng() % 50) + ".so";
+        regions.emplace_back(addr, addr + size, "r-xp", rng() % 0x100000, pathname);
+        addr += size;
+    }
+
+    std::shuffle(regions.begin(), regions.end(), rng);
+    for (const auto& r : regions)
+        index.add({r.start, r.end, r.offset, pathnames.intern(r.pathname)});
+
+    REQUIRE(index.size() == regions.size());
+
+    for (int i = 0; i < 20000; i++)
+    {
+        std::uintptr_t ip = 0x3ff000 + rng() % (addr - 0x3ff000 + 0x2000);
+
+        auto expected = std::find_if(regions.begin(), regions.end(), [&](const auto& r) { return r.contains(ip); });
+        auto found = index.find(ip);
+
+        if (expected == regions.end())
+            REQUIRE(found == nullptr);
+        else
+        {
+            REQUIRE(found != nullptr);
+            REQUIRE(found->start == expected->start);
+            REQUIRE(found->offset == expected->offset);
+            REQUIRE(pathnames.get(found->pathname) == expected->pathname);
+        }
+    }
+}
+
+} // namespace
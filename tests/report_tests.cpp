@@ -0,0 +1,70 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "report.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+const std::string profile =
+    "# 2019-11-04 11:09:46: oneshot profiling\n"
+    "$ time;cpu;pid;comm;pathname;addr;name\n"
+    "100;0;0;<swapper>;-;0xffffffff8aa7504a;-\n"
+    "200;0;3607;chrome;<kernelmain>;0xffffffff8b420a21;timerqueue_add\n"
+    "300;0;3607;chrome;<kernelmain>;0xffffffff8b420a21;timerqueue_add\n"
+    "400;0;2844;pulseaudio;/usr/lib/libprotocol-native.so;0x9bb0;-\n"
+    "# 2019-11-04 11:09:47: done\n"
+    "$ count;percent;pid;comm;pathname;addr;name\n"
+    "5;100.00;3607;chrome;<kernelmain>;0xffffffff8b420a21;timerqueue_add\n";
+
+} // namespace
+
+TEST_CASE("profile columns are found by their names")
+{
+    profile_columns columns{"$ time;cpu;pid;comm;pathname;addr;name"};
+    REQUIRE(columns.valid());
+    REQUIRE(columns.time == 0);
+    REQUIRE(columns.name == 6);
+    REQUIRE(columns.count == -1);
+
+    profile_entry entry;
+    REQUIRE(parse_entry("200;0;3607;chrome;<kernelmain>;0xffffffff8b420a21;timerqueue_add", columns, entry));
+    REQUIRE(entry.time == 200);
+    REQUIRE(entry.pid == 3607);
+    REQUIRE(entry.comm == "chrome");
+    REQUIRE(entry.addr == "0xffffffff8b420a21");
+    REQUIRE(entry.name == "timerqueue_add");
+    REQUIRE(!parse_entry("200;0;3607", columns, entry));
+}
+
+TEST_CASE("profile is counted the same however many threads do it")
+{
+    for (std::size_t threads = 1; threads <= 12; threads++)
+    {
+        auto summary = count_entries(profile, threads);
+        REQUIRE(summary.entries.size() == 3);
+        REQUIRE(summary.timed);
+        REQUIRE(summary.first_time == 100);
+        REQUIRE(summary.last_time == 400);
+
+        const auto& chrome = summary.entries.at({3607, "chrome", "<kernelmain>", "0xffffffff8b420a21", "timerqueue_add"});
+        REQUIRE(chrome.count == 7);
+        REQUIRE(chrome.first == profile.find("200;"));
+    }
+}
+
+TEST_CASE("profile without a format line is refused")
+{
+    REQUIRE_THROWS(count_entries("100;0;0;<swapper>;-;0x0;-\n", 1));
+}
+
+} // namespace
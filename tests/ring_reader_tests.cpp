@@ -0,0 +1,145 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "perf.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+/**
+ * Ring in plain memory, written the way the kernel does it.
+ */
+struct fake_ring
+{
+    explicit fake_ring(std::size_t size) : data(size)
+    {
+    }
+
+    void write_sample(std::uint64_t ip)
+    {
+        struct
+        {
+            perf_event_header header;
+            sample_t sample;
+        } record{};
+
+        record.header.type = PERF_RECORD_SAMPLE;
+        record.header.size = sizeof(record);
+        record.sample.ip = ip;
+        write(&record, sizeof(record));
+    }
+
+    void write_lost(std::uint64_t lost)
+    {
+        struct
+        {
+            perf_event_header header;
+            std::uint64_t id;
+            std::uint64_t lost;
+        } record{};
+
+        record.header.type = PERF_RECORD_LOST;
+        record.header.size = sizeof(record);
+        record.lost = lost;
+        write(&record, sizeof(record));
+    }
+
+    // throttle and unthrottle records share the layout
+    void write_throttle(std::uint32_t type)
+    {
+        struct
+        {
+            perf_event_header header;
+            std::uint64_t time;
+            std::uint64_t id;
+            std::uint64_t stream_id;
+        } record{};
+
+        record.header.type = type;
+        record.header.size = sizeof(record);
+        write(&record, sizeof(record));
+    }
+
+    void write(const void* p, std::size_t size)
+    {
+        auto bytes = reinterpret_cast<const char*>(p);
+        for (std::size_t i = 0; i < size; i++)
+            data[(metadata.data_head + i) % data.size()] = bytes[i];
+        metadata.data_head += size;
+    }
+
+    perf_event_mmap_page metadata{};
+    std::vector<char> data;
+};
+
+} // namespace
+
+TEST_CASE("records are read across the end of the ring")
+{
+    // 5 samples of 40 bytes do not fit into 128 bytes evenly
+    fake_ring ring{128};
+    auto reader = std::make_unique<ring_reader>(&ring.metadata, ring.data.data(), ring.data.size());
+
+    std::vector<std::uint64_t> ips;
+    auto read = [&]
+    {
+        reader->read([&](const perf_event_header& header)
+        {
+            REQUIRE(header.type == PERF_RECORD_SAMPLE);
+            ips.push_back(reinterpret_cast<const sample_t*>(record_body(header))->ip);
+        });
+    };
+
+    for (std::uint64_t i = 0; i < 20; i++)
+    {
+        ring.write_sample(i);
+        if (i % 3 == 2)
+        {
+            read();
+            REQUIRE(ring.metadata.data_tail == ring.metadata.data_head);
+        }
+    }
+    read();
+
+    REQUIRE(ips.size() == 20);
+    for (std::uint64_t i = 0; i < 20; i++)
+        REQUIRE(ips[i] == i);
+}
+
+TEST_CASE("lost and throttle records are counted in the ring stats")
+{
+    fake_ring ring{4096};
+    ring_reader reader{&ring.metadata, ring.data.data(), ring.data.size()};
+
+    ring.write_sample(1);
+    ring.write_lost(5);
+    ring.write_throttle(PERF_RECORD_THROTTLE);
+    ring.write_throttle(PERF_RECORD_UNTHROTTLE);
+    ring.write_sample(2);
+    ring.write_lost(3);
+    ring.write_throttle(PERF_RECORD_THROTTLE);
+
+    ring_stats stats;
+    std::vector<std::uint64_t> ips;
+    std::vector<std::uint32_t> others;
+    read_records(reader, stats, [&](const sample_t& sample) { ips.push_back(sample.ip); },
+        [&](const perf_event_header& header, const void*) { others.push_back(header.type); });
+
+    REQUIRE(stats.lost == 8);
+    REQUIRE(stats.throttled == 2);
+    REQUIRE(ips == std::vector<std::uint64_t>{1, 2});
+    // unthrottling is not counted, it is left to the caller
+    REQUIRE(others == std::vector<std::uint32_t>{PERF_RECORD_UNTHROTTLE});
+    REQUIRE(ring.metadata.data_tail == ring.metadata.data_head);
+}
+
+} // namespace
@@ -0,0 +1,56 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "reader.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+profile_sample sample_at(std::uint64_t time)
+{
+    profile_sample ret{};
+    ret.time = time;
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("samples are merged while a cpu produces none")
+{
+    constexpr auto slack = sample_merger::watermark_slack;
+
+    sample_merger merger{2};
+    std::vector<std::uint64_t> times;
+    auto pop = [&](const profile_sample& s) { times.push_back(s.time); };
+
+    for (std::uint64_t t : {slack + 10, slack + 20, 3 * slack})
+        merger.queue(0).push_back(sample_at(t));
+    merger.set_watermark(0, 4 * slack);
+
+    // an idle cpu which has not published its watermark holds everything back
+    merger.pop_ready(pop);
+    REQUIRE(times.empty());
+
+    // once it does, without a single sample, the others go on
+    merger.set_watermark(1, 3 * slack);
+    merger.pop_ready(pop);
+    REQUIRE(times == std::vector<std::uint64_t>{slack + 10, slack + 20});
+    REQUIRE(merger.queue(0).size() == 1);
+
+    merger.set_watermark(0, 5 * slack);
+    merger.set_watermark(1, 5 * slack);
+    merger.pop_ready(pop);
+    REQUIRE(times.size() == 3);
+    REQUIRE(merger.queue(0).empty());
+}
+
+} // namespace
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "sample.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("fixed size sample is decoded in kernel order")
+{
+    constexpr auto type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_PERIOD;
+    static_assert(sample<type>::fixed_size, "");
+    static_assert(sample_fields::fixed_body_size(type) == 40, "");
+
+    std::uint64_t body[] = {0xffffffff81000000, (std::uint64_t(12) << 32) | 11, 1000, 3, 7000};
+    auto s = decode_sample<type>(reinterpret_cast<const char*>(body));
+
+    REQUIRE(s.ip == 0xffffffff81000000);
+    REQUIRE(s.pid == 11);
+    REQUIRE(s.tid == 12);
+    REQUIRE(s.time == 1000);
+    REQUIRE(s.cpu == 3);
+    REQUIRE(s.period == 7000);
+}
+
+TEST_CASE("fields after callchain are found")
+{
+    constexpr auto type = PERF_SAMPLE_IP | PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_WEIGHT;
+    static_assert(!sample<type>::fixed_size, "");
+
+    std::uint64_t body[] = {0x400000, 3, 0x400000, 0x400100, 0x400200, 42};
+    auto s = decode_sample<type>(reinterpret_cast<const char*>(body));
+
+    REQUIRE(s.ip == 0x400000);
+    REQUIRE(s.nr == 3);
+    REQUIRE(s.ips[2] == 0x400200);
+    REQUIRE(s.weight == 42);
+}
+
+} // namespace
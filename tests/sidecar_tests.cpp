@@ -0,0 +1,85 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <fstream>
+
+#include "catch2/catch.hpp"
+#include "sidecar.hpp"
+#include "temp_file.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("regions hit by samples are written to the sidecar and read back")
+{
+    temp_file file;
+
+    // no real process has such a pid
+    const std::uint32_t pid = 1u << 30;
+    const elf_symbols exe{"/proc/self/exe"};
+
+    running_processes_snapshot processes{kernel_symbols{}, {}};
+    processes.on_mmap(pid, region_t{0x400000, 0x500000, "r-xp", 0x1000, "/proc/self/exe", exe.dev(), exe.inode()});
+    processes.find_symbol(pid, 0x400100);
+    processes.find_symbol(pid, 0x400200);
+
+    // the same path mapped before the binary was replaced, it cannot be read anymore
+    processes.on_mmap(pid + 1, region_t{0x400000, 0x500000, "r-xp", 0x1000, "/proc/self/exe", exe.dev(), 1});
+    processes.find_symbol(pid + 1, 0x400100);
+
+    // too long a path is cut
+    processes.on_mmap(pid + 2, region_t{0x400000, 0x500000, "r-xp", 0, "/" + std::string(0x10000, 'x'), 1, 2});
+    processes.find_symbol(pid + 2, 0x400100);
+
+    auto hits = processes.take_hits();
+    REQUIRE(hits.size() == 3);
+    REQUIRE(processes.take_hits().empty());
+
+    write_sidecar(file.path, 1234, hits, processes);
+    write_sidecar(file.path, 5678, {}, processes);
+
+    auto contents = read_sidecar(file.path);
+    REQUIRE(contents.profiles.size() == 2);
+    REQUIRE(contents.profiles[1].time == 5678);
+    REQUIRE(contents.profiles[1].maps.empty());
+
+    const auto& profile = contents.profiles[0];
+    REQUIRE(profile.time == 1234);
+    REQUIRE(profile.maps.size() == 3);
+    REQUIRE(profile.dsos.size() == 3);
+
+    std::unordered_map<std::uint32_t, sidecar_contents::map> maps;
+    for (const auto& map : profile.maps)
+        maps[map.pid] = map;
+
+    const auto& map = maps.at(pid);
+    REQUIRE(map.start == 0x400000);
+    REQUIRE(map.end == 0x500000);
+    REQUIRE(map.offset == 0x1000);
+
+    const auto& dso = profile.dsos.at(map.dso);
+    REQUIRE(dso.path == "/proc/self/exe");
+    REQUIRE(dso.dev == exe.dev());
+    REQUIRE(dso.inode == exe.inode());
+    REQUIRE(dso.build_id == exe.build_id());
+
+    const auto& replaced = profile.dsos.at(maps.at(pid + 1).dso);
+    REQUIRE(replaced.path == "/proc/self/exe");
+    REQUIRE(replaced.inode == 1);
+    REQUIRE(replaced.build_id.empty());
+
+    const auto& cut = profile.dsos.at(maps.at(pid + 2).dso);
+    REQUIRE(cut.path == "/" + std::string(0xfffe, 'x'));
+    REQUIRE(cut.dev == 1);
+    REQUIRE(cut.inode == 2);
+
+    // a profile cut short by a crash loses only its last record
+    const auto data = file.contents();
+    std::ofstream{file.path, std::ios::binary | std::ios::trunc} << data.substr(0, data.size() - 3);
+    REQUIRE(read_sidecar(file.path).profiles.size() == 1);
+}
+
+} // namespace
@@ -0,0 +1,70 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "spsc_queue.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("spsc queue is bounded")
+{
+    spsc_queue<int> q{2};
+    REQUIRE(q.front() == nullptr);
+
+    *q.back() = 1;
+    q.push();
+    *q.back() = 2;
+    q.push();
+    REQUIRE(q.back() == nullptr);
+
+    REQUIRE(*q.front() == 1);
+    q.pop();
+    REQUIRE(q.back() != nullptr);
+    REQUIRE(*q.front() == 2);
+    q.pop();
+    REQUIRE(q.front() == nullptr);
+}
+
+TEST_CASE("spsc queue keeps the order across threads")
+{
+    constexpr int count = 100000;
+    spsc_queue<std::vector<int>> q{4};
+
+    std::thread producer{[&]
+    {
+        for (int i = 0; i < count;)
+        {
+            if (auto slot = q.back())
+            {
+                slot->assign(3, i++);
+                q.push();
+            }
+            else
+                std::this_thread::yield();
+        }
+    }};
+
+    int expected = 0;
+    while (expected < count)
+    {
+        if (auto slot = q.front())
+        {
+            REQUIRE(*slot == std::vector<int>(3, expected++));
+            q.pop();
+        }
+        else
+            std::this_thread::yield();
+    }
+
+    producer.join();
+    REQUIRE(q.front() == nullptr);
+}
+
+} // namespace
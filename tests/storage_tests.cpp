@@ -0,0 +1,120 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "catch2/catch.hpp"
+#include "storage.hpp"
+
+namespace poor_perf
+{
+
+namespace
+{
+
+const std::string dir = "storage_tests";
+
+void remove_all()
+{
+    for (int i = 0; i < 20; i++)
+        for (auto suffix : {"", ".gz", ".maps"})
+            std::remove((dir + "/profile.txt." + std::to_string(i) + suffix).c_str());
+    std::remove((dir + "/profile.txt").c_str());
+    std::remove((dir + "/profile.txt.old").c_str());
+    ::rmdir(dir.c_str());
+}
+
+void write_profile(const profile_target& target, std::size_t size)
+{
+    std::ofstream{target.path} << std::string(size, 'x');
+    std::ofstream{target.sidecar} << "maps";
+}
+
+bool exists(const std::string& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0;
+}
+
+} // namespace
+
+TEST_CASE("profiles are appended to the output without rotation")
+{
+    profile_storage storage{"/rom/profile.txt", 0, 0, false};
+    REQUIRE(!storage.rotating());
+
+    auto target = storage.next();
+    REQUIRE(target.path == "/rom/profile.txt");
+    REQUIRE(target.sidecar == "/rom/profile.txt.maps");
+    REQUIRE(target.preallocate == 0);
+    REQUIRE(storage.next().path == "/rom/profile.txt");
+
+    REQUIRE(profile_storage{"-", 0, 0, false}.next().sidecar.empty());
+}
+
+TEST_CASE("only the last profiles are kept")
+{
+    remove_all();
+    ::mkdir(dir.c_str(), 0755);
+    std::ofstream{dir + "/profile.txt.old"} << "not a profile";
+
+    {
+        profile_storage storage{dir + "/profile.txt", 3, 0, false};
+        for (int i = 1; i <= 5; i++)
+        {
+            auto target = storage.next();
+            REQUIRE(target.path == dir + "/profile.txt." + std::to_string(i));
+            REQUIRE(target.sidecar == target.path + ".maps");
+            REQUIRE(target.preallocate == (i == 1 ? 0u : 100u));
+
+            write_profile(target, 100);
+            storage.prune();
+        }
+    }
+
+    REQUIRE(!exists(dir + "/profile.txt.2"));
+    REQUIRE(!exists(dir + "/profile.txt.2.maps"));
+    REQUIRE(exists(dir + "/profile.txt.3"));
+    REQUIRE(exists(dir + "/profile.txt.5.maps"));
+    REQUIRE(exists(dir + "/profile.txt.old"));
+
+    // numbering goes on after a restart
+    profile_storage storage{dir + "/profile.txt", 3, 0, true};
+    REQUIRE(storage.next().path == dir + "/profile.txt.6.gz");
+
+    remove_all();
+}
+
+TEST_CASE("profiles are removed until they fit into the size")
+{
+    remove_all();
+    ::mkdir(dir.c_str(), 0755);
+
+    profile_storage storage{dir + "/profile.txt", 0, 1000, false};
+    write_profile(storage.next(), 400);
+    write_profile(storage.next(), 400);
+    REQUIRE(storage.prune() == 0);
+
+    write_profile(storage.next(), 400);
+    REQUIRE(storage.prune() == 1);
+    REQUIRE(!exists(dir + "/profile.txt.1"));
+    REQUIRE(exists(dir + "/profile.txt.2"));
+
+    // the newest one stays even when it alone is over
+    auto target = storage.next();
+    REQUIRE(target.preallocate == 400);
+    write_profile(target, 2000);
+    REQUIRE(storage.prune() == 2);
+    REQUIRE(exists(dir + "/profile.txt.4"));
+
+    remove_all();
+}
+
+} // namespace
@@ -0,0 +1,58 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace poor_perf
+{
+
+/**
+ * Empty file with a unique name in the working directory, ending with
+ * `suffix`, for a test to write to and read back. It is removed along with
+ * the object.
+ */
+struct temp_file
+{
+    explicit temp_file(const std::string& suffix = "")
+    {
+        std::string name = "poor-perf-tests-XXXXXX" + suffix;
+        auto fd = ::mkstemps(name.data(), static_cast<int>(suffix.size()));
+        if (fd == -1)
+            throw std::runtime_error{"could not create a temporary file"};
+        ::close(fd);
+        path = name;
+    }
+
+    temp_file(const temp_file&) = delete;
+    temp_file& operator=(const temp_file&) = delete;
+
+    ~temp_file()
+    {
+        std::remove(path.c_str());
+    }
+
+    /**
+     * Whatever is in the file now.
+     */
+    std::string contents() const
+    {
+        std::ifstream f{path, std::ios::binary};
+        return {std::istreambuf_iterator<char>{f}, {}};
+    }
+
+    std::string path;
+};
+
+} // namespace
@@ -0,0 +1,85 @@
+/**
+ * Copyright 2019 Nokia
+ *
+ * Licensed under the BSD 3 Clause license
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "watchdog.hpp"
+
+namespace poor_perf
+{
+
+TEST_CASE("latency histogram buckets cover every value")
+{
+    for (std::uint64_t value : {0ul, 1ul, 63ul, 64ul, 65ul, 1000ul, 123456789ul, ~std::uint64_t(0)})
+    {
+        const auto bucket = latency_histogram::bucket_of(value);
+        REQUIRE(bucket < latency_histogram::buckets);
+        REQUIRE(latency_histogram::lowest_of(bucket) <= value);
+        REQUIRE(latency_histogram::highest_of(bucket) >= value);
+
+        // within about 3% of the value
+        REQUIRE(latency_histogram::highest_of(bucket) - latency_histogram::lowest_of(bucket) <= value / 32);
+    }
+
+    for (std::size_t bucket = 1; bucket < latency_histogram::buckets; bucket++)
+        REQUIRE(latency_histogram::lowest_of(bucket) == latency_histogram::highest_of(bucket - 1) + 1);
+}
+
+TEST_CASE("latency histogram percentiles")
+{
+    latency_histogram h;
+    REQUIRE(h.percentile(0.99) == 0);
+
+    for (std::uint64_t i = 1; i <= 1000; i++)
+        h.record(i * 1000);
+
+    REQUIRE(h.count() == 1000);
+    REQUIRE(h.max() == 1000000);
+    REQUIRE(h.percentile(0.5) >= 500000);
+    REQUIRE(h.percentile(0.5) <= 500000 * 33 / 32);
+    REQUIRE(h.percentile(0.99) >= 990000);
+    REQUIRE(h.percentile(1) == 1000000);
+
+    latency_histogram other;
+    other.record(5000000);
+    h.merge(other);
+    REQUIRE(h.count() == 1001);
+    REQUIRE(h.max() == 5000000);
+
+    h.reset();
+    REQUIRE(h.count() == 0);
+    REQUIRE(h.max() == 0);
+}
+
+TEST_CASE("latency histogram counts wakeups missed during a stall")
+{
+    latency_histogram h;
+    h.record_corrected(1050, 100);
+
+    // 1050, 950, ..., 50
+    REQUIRE(h.count() == 11);
+    REQUIRE(h.max() == 1050);
+    REQUIRE(h.percentile(0.5) >= 550);
+    REQUIRE(h.percentile(0.5) <= 550 * 33 / 32);
+
+    std::ostringstream ss;
+    ss << h;
+    REQUIRE(ss.str().find("11 wakeups") == 0);
+}
+
+TEST_CASE("watchdog which is not starved is not late")
+{
+    watchdog wdg{0, std::chrono::milliseconds{5}, std::chrono::seconds{0}};
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+
+    REQUIRE(wdg.cpu() == 0);
+    REQUIRE(wdg.lateness() < std::chrono::seconds{1});
+}
+
+} // namespace